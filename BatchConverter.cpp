@@ -0,0 +1,235 @@
+#include "BatchConverter.h"
+#include "OutputCache.h"
+#include "Instrumentation.h"
+#include "BoundedQueue.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+BatchConverter::BatchConverter(BatchOptions options) {
+	this->options = options;
+	this->options.Export.Arena = &arena;
+}
+
+BatchResult BatchConverter::Run(const std::vector<BatchJob>& jobs) {
+	BatchResult result = options.Pipelined ? RunPipelined(jobs) : RunSequential(jobs);
+	// The batch's skeletons aren't kept once it is done
+	Skeleton::ClearSkeletonCache();
+	return result;
+}
+
+BatchResult BatchConverter::RunSequential(const std::vector<BatchJob>& jobs) {
+	BatchResult result;
+	OutputCache* cache = NULL;
+	if (options.CacheDirectory != "") {
+		cache = new OutputCache(options.CacheDirectory, options.MaxCacheBytes);
+	}
+	// Lods can end up in their own files even when they weren't asked for separately, e.g. for glb
+	bool removeOldLods = options.Export.LodMode != LodExportMode::DefaultLod;
+
+	for (int i = 0; i < jobs.size(); i++) {
+		const BatchJob& job = jobs[i];
+		uint64_t hash = 0;
+
+		if (cache != NULL) {
+			ScopedTimer timer("HashInputs");
+			hash = OutputCache::HashJob(job.MdlPath, options.Export);
+			if (cache->Restore(hash, job.OutputPath)) {
+				Instrumentation::Log(LogLevel::Info, "Unchanged, using cached output for %s", job.MdlPath.c_str());
+				result.Cached++;
+				continue;
+			}
+		}
+
+		if (removeOldLods) {
+			RemoveOldLods(job.OutputPath);
+		}
+
+		MdlToFbxConverter converter(job.MdlPath.c_str(), job.OutputPath.c_str(), options.Export);
+		if (converter.GetExportStatus() != 0) {
+			result.Failed++;
+			continue;
+		}
+		result.Converted++;
+
+		if (cache != NULL) {
+			std::vector<std::string> written = converter.GetWrittenFiles();
+			if (written.size() > 0) {
+				cache->Store(hash, job.MdlPath, written, IsSeparateLods(written, job.OutputPath));
+			}
+		}
+	}
+
+	if (cache != NULL) {
+		delete cache;
+	}
+	Instrumentation::Log(LogLevel::Info, "Batch finished: %i converted, %i from cache, %i failed", result.Converted, result.Cached, result.Failed);
+	return result;
+}
+
+struct PrefetchedJob {
+	int Index = 0;
+	uint64_t Hash = 0;
+};
+
+struct ConvertedJob {
+	int Index = 0;
+	uint64_t Hash = 0;
+	std::vector<std::pair<std::string, std::vector<char>>> Files;
+};
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Reading the next mdls, converting the current one, and writing the previous ones all overlap.
+// The queues between the stages are bounded, so a slow writer holds conversion back instead of
+// finished files piling up in memory, and a slow converter holds the reader back the same way.
+BatchResult BatchConverter::RunPipelined(const std::vector<BatchJob>& jobs) {
+	BatchResult result;
+	OutputCache* cache = NULL;
+	if (options.CacheDirectory != "") {
+		cache = new OutputCache(options.CacheDirectory, options.MaxCacheBytes);
+	}
+	// Restores happen on the converting thread and stores on the writing one
+	std::mutex cacheMutex;
+	bool removeOldLods = options.Export.LodMode != LodExportMode::DefaultLod;
+
+	BoundedQueue<PrefetchedJob> readQueue(options.PrefetchDepth);
+	BoundedQueue<ConvertedJob> writeQueue(options.WriteQueueDepth);
+	int written = 0;
+	int writeFailed = 0;
+	auto start = std::chrono::steady_clock::now();
+	// When each stage ran out of work. After that it is neither busy nor waiting on its neighbours.
+	double readSeconds = 0;
+	double convertSeconds = 0;
+
+	// Reads each mdl once, which both hashes it for the cache and leaves it in the OS file cache for the converter
+	std::thread reader([&] {
+		std::vector<char> data;
+		for (int i = 0; i < jobs.size(); i++) {
+			PrefetchedJob prefetched;
+			prefetched.Index = i;
+
+			std::ifstream ifs(jobs[i].MdlPath, std::ios::binary | std::ios::ate);
+			data.clear();
+			if (ifs.is_open()) {
+				data.resize((size_t)ifs.tellg());
+				ifs.seekg(0);
+				ifs.read(data.data(), data.size());
+			}
+			if (cache != NULL) {
+				prefetched.Hash = OutputCache::HashJob(jobs[i].MdlPath, options.Export, ifs.is_open() ? &data : NULL);
+			}
+			if (!readQueue.Push(prefetched)) {
+				break;
+			}
+		}
+		readQueue.Close();
+		readSeconds = SecondsSince(start);
+	});
+
+	std::thread writer([&] {
+		ConvertedJob converted;
+		while (writeQueue.Pop(converted)) {
+			const BatchJob& job = jobs[converted.Index];
+			if (removeOldLods) {
+				RemoveOldLods(job.OutputPath);
+			}
+
+			bool success = true;
+			std::vector<std::string> paths;
+			for (int f = 0; f < converted.Files.size(); f++) {
+				std::string& path = converted.Files[f].first;
+				std::vector<char>& data = converted.Files[f].second;
+				std::ofstream ofs(path, std::ios::binary);
+				ofs.write(data.data(), data.size());
+				if (!ofs.good()) {
+					Instrumentation::Log(LogLevel::Error, "Could not write %s", path.c_str());
+					success = false;
+					break;
+				}
+				paths.push_back(path);
+			}
+			if (!success || paths.size() == 0) {
+				writeFailed++;
+				continue;
+			}
+			written++;
+
+			if (cache != NULL) {
+				std::lock_guard<std::mutex> lock(cacheMutex);
+				cache->Store(converted.Hash, job.MdlPath, paths, IsSeparateLods(paths, job.OutputPath));
+			}
+		}
+	});
+
+	std::vector<std::pair<std::string, std::vector<char>>> files;
+	ExportOptions exportOptions = options.Export;
+	exportOptions.OutputSink = [&files](const std::string& path, std::vector<char>&& data) {
+		files.emplace_back(path, std::move(data));
+	};
+
+	PrefetchedJob prefetched;
+	while (readQueue.Pop(prefetched)) {
+		const BatchJob& job = jobs[prefetched.Index];
+
+		if (cache != NULL) {
+			std::lock_guard<std::mutex> lock(cacheMutex);
+			if (cache->Restore(prefetched.Hash, job.OutputPath)) {
+				Instrumentation::Log(LogLevel::Info, "Unchanged, using cached output for %s", job.MdlPath.c_str());
+				result.Cached++;
+				continue;
+			}
+		}
+
+		files.clear();
+		MdlToFbxConverter converter(job.MdlPath.c_str(), job.OutputPath.c_str(), exportOptions);
+		if (converter.GetExportStatus() != 0) {
+			result.Failed++;
+			continue;
+		}
+
+		ConvertedJob converted;
+		converted.Index = prefetched.Index;
+		converted.Hash = prefetched.Hash;
+		converted.Files = std::move(files);
+		writeQueue.Push(std::move(converted));
+	}
+	writeQueue.Close();
+	convertSeconds = SecondsSince(start);
+	reader.join();
+	writer.join();
+
+	double elapsed = SecondsSince(start);
+	result.Converted = written;
+	result.Failed += writeFailed;
+	if (elapsed > 0) {
+		result.ReadUtilisation = std::max(0.0, (readSeconds - readQueue.GetPushWaitSeconds()) / elapsed);
+		result.ConvertUtilisation = std::max(0.0, (convertSeconds - readQueue.GetPopWaitSeconds() - writeQueue.GetPushWaitSeconds()) / elapsed);
+		result.WriteUtilisation = std::max(0.0, 1.0 - writeQueue.GetPopWaitSeconds() / elapsed);
+	}
+
+	if (cache != NULL) {
+		delete cache;
+	}
+	Instrumentation::Log(LogLevel::Info, "Batch finished: %i converted, %i from cache, %i failed", result.Converted, result.Cached, result.Failed);
+	Instrumentation::Log(LogLevel::Info, "Stage utilisation: read %.0f%%, convert %.0f%%, write %.0f%%",
+		result.ReadUtilisation * 100, result.ConvertUtilisation * 100, result.WriteUtilisation * 100);
+	return result;
+}
+
+// Old lods could otherwise be picked up as part of a job's output
+void BatchConverter::RemoveOldLods(std::string outputPath) {
+	std::error_code ec;
+	for (int lod = 0; lod < 8; lod++) {
+		std::filesystem::remove(GetLodOutputPath(outputPath, lod), ec);
+	}
+}
+
+// Whether the files were written with GetLodOutputPath, so the cache puts them back the same way
+bool BatchConverter::IsSeparateLods(const std::vector<std::string>& writtenFiles, std::string outputPath) {
+	return writtenFiles.size() > 0 && writtenFiles[0] != outputPath;
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "MdlToFbxConverter.h"
+
+struct BatchJob {
+	std::string MdlPath;
+	std::string OutputPath;
+};
+
+struct BatchOptions {
+	ExportOptions Export;
+	// Empty disables the cache and every job is converted
+	std::string CacheDirectory = "";
+	unsigned long long MaxCacheBytes = 4ULL * 1024 * 1024 * 1024;
+	// Read ahead and write behind on their own threads while the current job converts
+	bool Pipelined = true;
+	// How many jobs can be read ahead of, or wait to be written behind, the one being converted
+	int PrefetchDepth = 4;
+	int WriteQueueDepth = 4;
+};
+
+struct BatchResult {
+	int Converted = 0;
+	int Cached = 0;
+	int Failed = 0;
+	// Fraction of the run each pipeline stage spent working rather than waiting on its neighbours
+	double ReadUtilisation = 0;
+	double ConvertUtilisation = 0;
+	double WriteUtilisation = 0;
+};
+
+// Converts many mdls with the same options, sharing scratch memory between jobs and skipping any
+// whose inputs and options hash to something already in the cache.
+class BatchConverter
+{
+public:
+	BatchConverter(BatchOptions options);
+
+	BatchResult Run(const std::vector<BatchJob>& jobs);
+
+private:
+	BatchOptions options;
+	ScratchArena arena;
+
+	BatchResult RunSequential(const std::vector<BatchJob>& jobs);
+	BatchResult RunPipelined(const std::vector<BatchJob>& jobs);
+	void RemoveOldLods(std::string outputPath);
+	static bool IsSeparateLods(const std::vector<std::string>& writtenFiles, std::string outputPath);
+};
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "BatchImporter.h"
+#include "FbxToMdlConverter.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+BatchImporter::BatchImporter(int threadCount, bool optimizeVertexCache) {
+	this->optimizeVertexCache = optimizeVertexCache;
+	if (threadCount <= 0) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	this->threadCount = threadCount > 0 ? threadCount : 1;
+}
+
+BatchImportResult BatchImporter::Run(const std::vector<std::string>& fbxFilePaths) {
+	BatchImportResult result;
+	result.Files.resize(fbxFilePaths.size());
+	auto start = std::chrono::steady_clock::now();
+
+	// Files are handed out one at a time, so a few large files don't leave the other workers idle
+	std::atomic<int> nextFile(0);
+	auto work = [&]() {
+		FbxToMdlConverter converter;
+		converter.SetOptimizeVertexCache(optimizeVertexCache);
+		// The files are already spread over the cores
+		converter.SetThreadCount(1);
+		int i;
+		while ((i = nextFile++) < (int)fbxFilePaths.size()) {
+			ImportFileResult& file = result.Files[i];
+			file.Path = fbxFilePaths[i];
+			file.Status = converter.ImportFbx(file.Path);
+			file.Report = converter.GetLastReport();
+		}
+	};
+
+	int workers = std::min(threadCount, (int)fbxFilePaths.size());
+	std::vector<std::thread> threads;
+	for (int t = 1; t < workers; t++) {
+		threads.emplace_back(work);
+	}
+	if (workers > 0) {
+		work();
+	}
+	for (int t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+
+	for (int i = 0; i < result.Files.size(); i++) {
+		if (result.Files[i].Status == 0) {
+			result.Imported++;
+		}
+		else {
+			result.Failed++;
+			Instrumentation::Log(LogLevel::Warning, "Failed to import %s", result.Files[i].Path.c_str());
+		}
+	}
+	result.TotalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	Instrumentation::Log(LogLevel::Info, "Batch import finished: %i imported, %i failed in %.0f ms on %i threads", result.Imported, result.Failed, result.TotalMilliseconds, workers);
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Instrumentation.h"
+
+struct ImportFileResult {
+	std::string Path;
+	// What ImportFbx returned; 0 on success
+	int Status = 0;
+	ConversionReport Report;
+};
+
+struct BatchImportResult {
+	int Imported = 0;
+	int Failed = 0;
+	double TotalMilliseconds = 0;
+	// In the same order as the paths that were passed in
+	std::vector<ImportFileResult> Files;
+};
+
+// Imports many fbx files in parallel. Every worker thread keeps its own FbxToMdlConverter, and with it
+// one FbxManager and scratch arena, for all the files it picks up.
+class BatchImporter
+{
+public:
+	// 0 uses one thread per core
+	BatchImporter(int threadCount = 0, bool optimizeVertexCache = false);
+
+	BatchImportResult Run(const std::vector<std::string>& fbxFilePaths);
+
+private:
+	int threadCount;
+	bool optimizeVertexCache;
+};
\ No newline at end of file
@@ -13,6 +13,8 @@ public:
 	Bone* Parent = nullptr;
 	std::vector<Bone*> Children;
 	Eigen::Transform<double, 3, Eigen::Affine> PoseMatrix = Eigen::Affine3d::Identity();
+	// PoseMatrix multiplied down from the root, filled in by Skeleton::ComputeWorldMatrices
+	Eigen::Matrix4d WorldMatrix = Eigen::Matrix4d::Identity();
 
 	Bone* GetBone(std::string name);
 };
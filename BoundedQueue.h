@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Blocking queue between two pipeline stages. Push waits while it is full, which is what holds a fast
+// stage back to the pace of a slow one. Time spent waiting is accumulated so stages can report how busy they were.
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+	// False if the queue was closed before the item could be added
+	bool Push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		auto start = std::chrono::steady_clock::now();
+		notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+		pushWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (closed) {
+			return false;
+		}
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// False once the queue is closed and everything in it has been taken
+	bool Pop(T& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		auto start = std::chrono::steady_clock::now();
+		notEmpty.wait(lock, [this] { return items.size() > 0 || closed; });
+		popWaitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (items.size() == 0) {
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	// No more items will be pushed; consumers drain what is left
+	void Close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notEmpty.notify_all();
+		notFull.notify_all();
+	}
+
+	double GetPushWaitSeconds() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return pushWaitSeconds;
+	}
+
+	double GetPopWaitSeconds() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return popWaitSeconds;
+	}
+
+private:
+	std::deque<T> items;
+	size_t capacity;
+	bool closed = false;
+	double pushWaitSeconds = 0;
+	double popWaitSeconds = 0;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+};
\ No newline at end of file
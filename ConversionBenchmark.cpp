@@ -0,0 +1,332 @@
+#include "ConversionBenchmark.h"
+#include "MdlToFbxConverter.h"
+#include "FbxToMdlConverter.h"
+#include "Instrumentation.h"
+#include "include/json.hpp"
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+using json = nlohmann::json;
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+static double MillisecondsSince(BenchmarkClock::time_point start) {
+	return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+ConversionBenchmark::ConversionBenchmark(BenchmarkConfig config) {
+	this->config = config;
+
+	if (this->config.PartCount < 1) this->config.PartCount = 1;
+	if (this->config.BoneCount < 1) this->config.BoneCount = 1;
+	if (this->config.ShapeCount < 0) this->config.ShapeCount = 0;
+	if (this->config.Iterations < 1) this->config.Iterations = 1;
+
+	// Every part plus one replacement vertex per shaped index has to fit in the mesh's uint16_t indices
+	int maxVertices = 65535 / (this->config.PartCount * 2);
+	if (this->config.VertexCount > maxVertices) {
+		Instrumentation::Log(LogLevel::Warning, "Clamping vertex count from %i to %i", this->config.VertexCount, maxVertices);
+		this->config.VertexCount = maxVertices;
+	}
+	if (this->config.VertexCount < 4) this->config.VertexCount = 4;
+}
+
+std::string ConversionBenchmark::Run() {
+	StageNames.clear();
+	StageMilliseconds.clear();
+
+	for (int i = 0; i < config.Iterations; i++) {
+		RunIteration();
+	}
+
+	json result;
+	result["config"] = {
+		{ "vertex_count", config.VertexCount },
+		{ "part_count", config.PartCount },
+		{ "shape_count", config.ShapeCount },
+		{ "bone_count", config.BoneCount },
+		{ "iterations", config.Iterations }
+	};
+	result["counters"] = {
+		{ "vertices", GeneratedVertices },
+		{ "indices", GeneratedIndices },
+		{ "exported_bytes", ExportedBytes }
+	};
+
+	json stages = json::array();
+	for (int i = 0; i < StageNames.size(); i++) {
+		std::vector<double>& times = StageMilliseconds[i];
+		double total = 0;
+		for (int j = 0; j < times.size(); j++) {
+			total += times[j];
+		}
+		stages.push_back({
+			{ "stage", StageNames[i] },
+			{ "mean_ms", total / times.size() },
+			{ "min_ms", *std::min_element(times.begin(), times.end()) },
+			{ "max_ms", *std::max_element(times.begin(), times.end()) }
+		});
+	}
+	result["stages"] = stages;
+
+	return result.dump(2);
+}
+
+int ConversionBenchmark::WriteResults(std::string jsonPath) {
+	std::string results = Run();
+
+	std::ofstream ofs(jsonPath);
+	if (!ofs.is_open()) {
+		Instrumentation::Log(LogLevel::Error, "Could not write benchmark results to %s", jsonPath.c_str());
+		return -1;
+	}
+	ofs << results << std::endl;
+	ofs.close();
+	return 0;
+}
+
+// Stages are kept in the order they were first timed so the output reads like the pipeline
+void ConversionBenchmark::AddTime(std::string stage, double milliseconds) {
+	for (int i = 0; i < StageNames.size(); i++) {
+		if (StageNames[i] == stage) {
+			StageMilliseconds[i].push_back(milliseconds);
+			return;
+		}
+	}
+	StageNames.push_back(stage);
+	StageMilliseconds.push_back(std::vector<double>{ milliseconds });
+}
+
+void ConversionBenchmark::RunIteration() {
+	std::string skeletonPath = WriteSyntheticSkeleton();
+	std::string fbxPath = config.WorkingDirectory + "/benchmark.fbx";
+
+	Model* model = MakeSyntheticModel();
+	MdlToFbxConverter* converter = new MdlToFbxConverter();
+	converter->model = model;
+
+	auto start = BenchmarkClock::now();
+	converter->SetSkeletonFromFile(skeletonPath);
+	AddTime("skeleton_load", MillisecondsSince(start));
+
+	start = BenchmarkClock::now();
+	converter->InitScene();
+	AddTime("scene_init", MillisecondsSince(start));
+
+	double dedup = 0;
+	double build = 0;
+	double shapes = 0;
+	double skin = 0;
+
+	// Same sequence as AddModelToScene/AddPartToScene, with each step timed on its own
+	for (int i = 0; i < model->Meshes.size(); i++) {
+		Mesh* group = &model->Meshes[i];
+		FbxNode* groupNode = FbxNode::Create(converter->manager, ("Group " + std::to_string(i)).c_str());
+		converter->rootNode->AddChild(groupNode);
+
+		for (int p = 0; p < group->Submeshes.size(); p++) {
+			Submesh* part = &group->Submeshes[p];
+			std::pmr::string partName = converter->arena->Concat({ "model name Part ", std::to_string(group->MeshIndex), ".", std::to_string(p) });
+			int indicesOffset = group->Submeshes[0].IndexOffset;
+
+			start = BenchmarkClock::now();
+			PartVertices partVertices(converter->arena, converter->options.PackVertexStreams);
+			converter->GetUniquePartVertices(group, part, indicesOffset, partVertices);
+			dedup += MillisecondsSince(start);
+
+			start = BenchmarkClock::now();
+			FbxNode* node = FbxNode::Create(converter->manager, partName.c_str());
+			groupNode->AddChild(node);
+			FbxMesh* mesh = converter->MakeMesh(partVertices.Vertices, partVertices.Indices, converter->arena->Concat({ partName, " Mesh Attribute" }).c_str(), node, converter->GetSurfaceMaterial(group));
+			build += MillisecondsSince(start);
+
+			start = BenchmarkClock::now();
+			converter->ResolvePartShapes(group, part, indicesOffset, partVertices);
+			converter->AddShapesToMesh(partVertices, mesh, partName);
+			shapes += MillisecondsSince(start);
+
+			start = BenchmarkClock::now();
+			converter->AddSkinToMesh(group, partVertices, mesh, node, partName);
+			converter->bindPose->Add(node, node->EvaluateGlobalTransform());
+			skin += MillisecondsSince(start);
+		}
+	}
+	AddTime("vertex_dedup", dedup);
+	AddTime("fbx_build", build);
+	AddTime("shape_resolution", shapes);
+	AddTime("skin_clustering", skin);
+
+	start = BenchmarkClock::now();
+	converter->ExportScene(fbxPath);
+	AddTime("fbx_export", MillisecondsSince(start));
+
+	std::ifstream exported(fbxPath, std::ios::binary | std::ios::ate);
+	ExportedBytes = exported.is_open() ? (long long)exported.tellg() : 0;
+	exported.close();
+
+	converter->scene->Destroy();
+	converter->manager->Destroy();
+	// The model belongs to the benchmark, not the converter
+	converter->model = NULL;
+	// SetSkeletonFromFile builds a new skeleton every iteration, outside the cache, and the converter doesn't own it
+	Skeleton::DeleteSkeleton(converter->n_root);
+	converter->n_root = NULL;
+	delete converter;
+	DeleteSyntheticModel(model);
+
+	start = BenchmarkClock::now();
+	FbxToMdlConverter importer;
+	importer.ImportFbx(fbxPath);
+	AddTime("fbx_import", MillisecondsSince(start));
+}
+
+std::string ConversionBenchmark::GetBoneName(int boneNumber) {
+	char name[32];
+	snprintf(name, sizeof(name), "j_bench_%04i", boneNumber);
+	return std::string(name);
+}
+
+// Writes a TexTools style .skel file: n_root followed by a binary tree of bones
+std::string ConversionBenchmark::WriteSyntheticSkeleton() {
+	std::string path = config.WorkingDirectory + "/benchmark.skel";
+	std::ofstream ofs(path);
+
+	for (int i = 0; i <= config.BoneCount; i++) {
+		json bone;
+		bone["BoneNumber"] = i;
+		bone["BoneParent"] = i == 0 ? -1 : (i - 1) / 2;
+		bone["BoneName"] = i == 0 ? "n_root" : GetBoneName(i - 1);
+
+		// Column major, a small translation along y for every bone
+		std::vector<double> matrix = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, i == 0 ? 0.0 : 0.01, 0, 1 };
+		bone["PoseMatrix"] = matrix;
+		ofs << bone.dump() << "\n";
+	}
+	ofs.close();
+	return path;
+}
+
+// One mesh with PartCount square grid parts. Each shape replaces the vertices in its own slice of the index buffer.
+Model* ConversionBenchmark::MakeSyntheticModel() {
+	Model* model = new Model();
+
+	Material material;
+	material.MaterialPath = "/mt_c0101e0000_top_a.mtrl";
+	model->Materials.push_back(material);
+
+	int bonesInTable = std::min(config.BoneCount, 64);
+	for (int i = 0; i < config.BoneCount; i++) {
+		model->StringOffsetToStringMap.emplace(i * 16, GetBoneName(i));
+	}
+
+	Mesh group(0);
+	group.Parent = model;
+	for (int i = 0; i < bonesInTable; i++) {
+		group.BoneTable.push_back(i);
+	}
+
+	int gridWidth = (int)std::sqrt((double)config.VertexCount);
+	int gridHeight = config.VertexCount / gridWidth;
+
+	for (int p = 0; p < config.PartCount; p++) {
+		int firstVertex = group.Vertices.size();
+		for (int y = 0; y < gridHeight; y++) {
+			for (int x = 0; x < gridWidth; x++) {
+				Vertex v = Vertex();
+				v.Position[0] = x * 0.01f;
+				v.Position[1] = y * 0.01f;
+				v.Position[2] = p * 0.01f;
+				v.Position[3] = 1.0f;
+				v.Normal[0] = 0;
+				v.Normal[1] = 0;
+				v.Normal[2] = 1;
+				v.UV[0] = (float)x / gridWidth;
+				v.UV[1] = (float)y / gridHeight;
+				v.UV[2] = v.UV[0];
+				v.UV[3] = v.UV[1];
+				for (int c = 0; c < 4; c++) {
+					v.Color[c] = 1.0f;
+				}
+				for (int w = 0; w < 4; w++) {
+					v.BlendIndices[w] = (x + y + w) % bonesInTable;
+					v.BlendWeights[w] = w == 0 ? 0.7f : 0.1f;
+				}
+				group.Vertices.push_back(v);
+			}
+		}
+
+		Submesh part = Submesh();
+		part.IndexOffset = group.Indices.size();
+		for (int y = 0; y < gridHeight - 1; y++) {
+			for (int x = 0; x < gridWidth - 1; x++) {
+				int v0 = firstVertex + y * gridWidth + x;
+				int v1 = v0 + 1;
+				int v2 = v0 + gridWidth;
+				int v3 = v2 + 1;
+				int quad[6] = { v0, v2, v1, v1, v2, v3 };
+				for (int i = 0; i < 6; i++) {
+					group.Indices.push_back(quad[i]);
+				}
+			}
+		}
+		part.IndexNum = group.Indices.size() - part.IndexOffset;
+		group.Submeshes.push_back(part);
+	}
+
+	// Shapes replace every tenth vertex of their slice of the indices with a copy moved along the normal
+	int indexCount = group.Indices.size();
+	for (int s = 0; s < config.ShapeCount; s++) {
+		uint16_t startIndex[3] = { 0, 0, 0 };
+		uint16_t meshCount[3] = { 0, 0, 0 };
+		int sliceStart = indexCount * s / config.ShapeCount;
+		int sliceEnd = indexCount * (s + 1) / config.ShapeCount;
+
+		for (int p = 0; p < group.Submeshes.size(); p++) {
+			Submesh& part = group.Submeshes[p];
+			int partStart = std::max(sliceStart, (int)part.IndexOffset);
+			int partEnd = std::min(sliceEnd, (int)(part.IndexOffset + part.IndexNum));
+			if (partStart >= partEnd) {
+				continue;
+			}
+
+			Shape* shape = new Shape("shp_bench_" + std::to_string(s), startIndex, meshCount);
+			shape->ShapeValuesStartIndex = partStart;
+			for (int i = partStart; i < partEnd; i++) {
+				int vertexNum = group.Indices[i];
+				if (vertexNum % 10 != 0) {
+					continue;
+				}
+				Vertex moved = group.Vertices[vertexNum];
+				moved.Position[2] += 0.005f;
+
+				ShapeValueStruct value;
+				value.Offset = i;
+				value.Value = group.Vertices.size();
+				shape->ShapeValueStructs.push_back(value);
+				group.Vertices.push_back(moved);
+			}
+			part.Shapes.push_back(shape);
+		}
+	}
+
+	GeneratedVertices = group.Vertices.size();
+	GeneratedIndices = group.Indices.size();
+
+	model->Meshes.push_back(group);
+	model->Meshes[0].Material = &model->Materials[0];
+	return model;
+}
+
+void ConversionBenchmark::DeleteSyntheticModel(Model* model) {
+	for (int i = 0; i < model->Meshes.size(); i++) {
+		for (int p = 0; p < model->Meshes[i].Submeshes.size(); p++) {
+			std::vector<Shape*>& shapes = model->Meshes[i].Submeshes[p].Shapes;
+			for (int s = 0; s < shapes.size(); s++) {
+				delete shapes[s];
+			}
+			shapes.clear();
+		}
+	}
+	delete model;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "LuminaPlusPlus/Models/Models/Model.h"
+
+struct BenchmarkConfig {
+	// Vertices in each part; the parts share one mesh, so this is clamped to stay within 16 bit indices
+	int VertexCount = 4096;
+	int PartCount = 4;
+	int ShapeCount = 4;
+	int BoneCount = 64;
+	int Iterations = 5;
+	// Where the synthetic skeleton and the exported fbx are written
+	std::string WorkingDirectory = ".";
+};
+
+// Times each stage of an mdl -> fbx -> mdl round trip over generated data, so results don't depend on game files
+class ConversionBenchmark
+{
+public:
+	ConversionBenchmark(BenchmarkConfig config);
+
+	// Runs every iteration and returns the results as json
+	std::string Run();
+	int WriteResults(std::string jsonPath);
+
+private:
+	BenchmarkConfig config;
+	std::vector<std::string> StageNames;
+	std::vector<std::vector<double>> StageMilliseconds;
+	long long ExportedBytes = 0;
+	int GeneratedVertices = 0;
+	int GeneratedIndices = 0;
+
+	void RunIteration();
+	void AddTime(std::string stage, double milliseconds);
+	std::string WriteSyntheticSkeleton();
+	Model* MakeSyntheticModel();
+	void DeleteSyntheticModel(Model* model);
+	std::string GetBoneName(int boneNumber);
+};
@@ -0,0 +1,261 @@
+#include "ConverterServer.h"
+#include "Instrumentation.h"
+#include "BoundedQueue.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+ConverterServer::ConverterServer(ExportOptions defaults, int workerCount) {
+	this->defaults = defaults;
+	this->workerCount = workerCount > 0 ? workerCount : std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+static bool ReadUInt32(std::istream& in, uint32_t& value) {
+	unsigned char bytes[4];
+	if (!in.read((char*)bytes, 4)) {
+		return false;
+	}
+	value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+	return true;
+}
+
+static void WriteUInt32(std::ostream& out, uint32_t value) {
+	unsigned char bytes[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+	out.write((const char*)bytes, 4);
+}
+
+// Why a request header can't be used, or "" if it can. Every field is checked here, so nothing later reads one as
+// the wrong type.
+static std::string ValidateHeader(const nlohmann::json& header) {
+	const char* stringFields[] = { "type", "mdl", "output", "format", "skeleton" };
+	for (int i = 0; i < 5; i++) {
+		auto it = header.find(stringFields[i]);
+		if (it != header.end() && !it->is_string()) {
+			return std::string("\"") + stringFields[i] + "\" must be a string";
+		}
+	}
+	auto format = header.find("format");
+	if (format != header.end() && *format != "fbx" && *format != "glb") {
+		return "Unknown format";
+	}
+	auto lodMode = header.find("lodMode");
+	if (lodMode != header.end()) {
+		if (!lodMode->is_number_integer()) {
+			return "\"lodMode\" must be an integer";
+		}
+		long long mode = lodMode->get<long long>();
+		if (mode < (int)LodExportMode::DefaultLod || mode > (int)LodExportMode::SeparateFiles) {
+			return "Unknown lodMode";
+		}
+	}
+	return "";
+}
+
+void ConverterServer::SetMaxFrameLengths(uint32_t headerLength, uint32_t bodyLength) {
+	maxHeaderLength = headerLength;
+	maxBodyLength = bodyLength;
+}
+
+bool ConverterServer::ReadFrame(std::istream& in, ServerFrame& frame, uint32_t maxHeaderLength, uint32_t maxBodyLength) {
+	uint32_t headerLength = 0;
+	uint32_t bodyLength = 0;
+	if (!ReadUInt32(in, headerLength) || !ReadUInt32(in, bodyLength)) {
+		return false;
+	}
+
+	// Anything over the maximum is skipped without being kept, so the stream stays in step
+	std::string header(headerLength <= maxHeaderLength ? headerLength : 0, '\0');
+	frame.Body.resize(headerLength <= maxHeaderLength && bodyLength <= maxBodyLength ? bodyLength : 0);
+	std::streamsize skipped = (std::streamsize)headerLength + bodyLength - header.size() - frame.Body.size();
+	if (!in.read(&header[0], header.size()) || !in.read(frame.Body.data(), frame.Body.size()) ||
+		(skipped > 0 && in.ignore(skipped).gcount() != skipped)) {
+		Instrumentation::Log(LogLevel::Error, "Request frame ended early");
+		return false;
+	}
+
+	std::string error = "Request header is too long";
+	frame.Header = nlohmann::json();
+	if (headerLength <= maxHeaderLength) {
+		frame.Header = nlohmann::json::parse(header, nullptr, false);
+		error = "Request header is not a json object";
+		if (!frame.Header.is_discarded() && frame.Header.is_object()) {
+			error = bodyLength > maxBodyLength ? "Request body is too long" : ValidateHeader(frame.Header);
+		}
+	}
+	if (error != "") {
+		// Still a whole frame, so the stream stays in step; the request fails on its own
+		nlohmann::json id = frame.Header.is_object() ? frame.Header.value("id", nlohmann::json()) : nlohmann::json();
+		frame.Header = nlohmann::json::object();
+		frame.Header["id"] = id;
+		frame.Header["type"] = "invalid";
+		frame.Header["error"] = error;
+	}
+	return true;
+}
+
+void ConverterServer::WriteFrame(std::ostream& out, const ServerFrame& frame) {
+	std::string header = frame.Header.dump();
+	WriteUInt32(out, header.size());
+	WriteUInt32(out, frame.Body.size());
+	out.write(header.data(), header.size());
+	out.write(frame.Body.data(), frame.Body.size());
+	out.flush();
+}
+
+int ConverterServer::Serve(std::istream& in, std::ostream& out) {
+	BoundedQueue<ServerFrame> requests(workerCount * 2);
+	std::atomic<int> failed(0);
+	std::filesystem::path tempRoot = std::filesystem::temp_directory_path();
+
+	auto respond = [&](const ServerFrame& response) {
+		if (response.Header.value("status", 0) != 0) {
+			failed++;
+		}
+		std::lock_guard<std::mutex> lock(outputMutex);
+		WriteFrame(out, response);
+	};
+
+	std::vector<std::thread> workers;
+	for (int w = 0; w < workerCount; w++) {
+		workers.emplace_back([&, w] {
+			// Kept for every request this worker handles; starting the FBX SDK is most of a small conversion
+			FbxManager* manager = FbxManager::Create();
+			FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+			manager->SetIOSettings(ios);
+			ScratchArena arena;
+			std::string tempDirectory = (tempRoot / ("MdlFbxConverter_" + std::to_string(w))).string();
+
+			ServerFrame request;
+			while (requests.Pop(request)) {
+				respond(HandleRequest(request, manager, &arena, tempDirectory));
+			}
+
+			std::error_code ec;
+			std::filesystem::remove_all(tempDirectory, ec);
+			manager->Destroy();
+		});
+	}
+
+	int received = 0;
+	ServerFrame request;
+	while (ReadFrame(in, request, maxHeaderLength, maxBodyLength)) {
+		received++;
+		std::string type = request.Header.value("type", "convert");
+		if (type == "shutdown") {
+			ServerFrame response;
+			response.Header["id"] = request.Header.value("id", nlohmann::json());
+			response.Header["status"] = 0;
+			respond(response);
+			break;
+		}
+		if (type == "ping") {
+			// Answered straight away, even while every worker is busy
+			ServerFrame response;
+			response.Header["id"] = request.Header.value("id", nlohmann::json());
+			response.Header["status"] = 0;
+			respond(response);
+			continue;
+		}
+		requests.Push(std::move(request));
+		request = ServerFrame();
+	}
+
+	requests.Close();
+	for (int w = 0; w < workers.size(); w++) {
+		workers[w].join();
+	}
+	Skeleton::ClearSkeletonCache();
+	Instrumentation::Log(LogLevel::Info, "Server stopped after %i requests, %i failed", received, (int)failed);
+	return failed;
+}
+
+ServerFrame ConverterServer::HandleRequest(ServerFrame& request, FbxManager* manager, ScratchArena* arena, std::string tempDirectory) {
+	auto start = std::chrono::steady_clock::now();
+	ServerFrame response;
+	response.Header["id"] = request.Header.value("id", nlohmann::json());
+	response.Header["files"] = nlohmann::json::array();
+
+	auto fail = [&](const std::string& error) {
+		Instrumentation::Log(LogLevel::Error, "Request failed: %s", error.c_str());
+		response.Header["status"] = -1;
+		response.Header["error"] = error;
+		response.Body.clear();
+		return response;
+	};
+
+	std::string type = request.Header.value("type", "convert");
+	if (type == "invalid") {
+		return fail(request.Header.value("error", "Invalid request"));
+	}
+	if (type != "convert") {
+		return fail("Unknown request type");
+	}
+
+	std::string mdlPath = request.Header.value("mdl", "");
+	if (request.Body.size() > 0) {
+		// Mdls can only be loaded from a file, so an inline one is written out under its own name first
+		std::string name = std::filesystem::path(mdlPath).filename().string();
+		if (name == "") {
+			name = "inline.mdl";
+		}
+		std::error_code ec;
+		std::filesystem::create_directories(tempDirectory, ec);
+		mdlPath = (std::filesystem::path(tempDirectory) / name).string();
+		std::ofstream ofs(mdlPath, std::ios::binary);
+		ofs.write(request.Body.data(), request.Body.size());
+		if (!ofs.good()) {
+			return fail("Could not write " + mdlPath);
+		}
+	}
+	else if (mdlPath == "" || !std::filesystem::exists(mdlPath)) {
+		return fail("Could not find mdl: " + mdlPath);
+	}
+
+	ExportOptions options = defaults;
+	options.Manager = manager;
+	options.Arena = arena;
+	std::string format = request.Header.value("format", "fbx");
+	options.Format = format == "glb" ? ExportFormat::Glb : ExportFormat::Fbx;
+	options.LodMode = (LodExportMode)request.Header.value("lodMode", (int)options.LodMode);
+	options.SkeletonPath = request.Header.value("skeleton", options.SkeletonPath);
+
+	std::string outputPath = request.Header.value("output", "");
+	bool inlineOutput = outputPath == "";
+	if (inlineOutput) {
+		outputPath = std::filesystem::path(mdlPath).stem().string() + (options.Format == ExportFormat::Glb ? ".glb" : ".fbx");
+	}
+
+	std::vector<std::pair<std::string, std::vector<char>>> files;
+	options.OutputSink = [&files](const std::string& path, std::vector<char>&& data) {
+		files.emplace_back(path, std::move(data));
+	};
+
+	MdlToFbxConverter converter(mdlPath.c_str(), outputPath.c_str(), options);
+	if (converter.GetExportStatus() != 0 || files.size() == 0) {
+		return fail("Could not convert " + mdlPath);
+	}
+
+	for (int f = 0; f < files.size(); f++) {
+		std::string& path = files[f].first;
+		std::vector<char>& data = files[f].second;
+		if (inlineOutput) {
+			response.Body.insert(response.Body.end(), data.begin(), data.end());
+		}
+		else {
+			std::ofstream ofs(path, std::ios::binary);
+			ofs.write(data.data(), data.size());
+			if (!ofs.good()) {
+				return fail("Could not write " + path);
+			}
+		}
+		response.Header["files"].push_back({ { "path", path }, { "size", data.size() } });
+	}
+
+	response.Header["status"] = 0;
+	response.Header["milliseconds"] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return response;
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <mutex>
+#include <cstdint>
+#include "include/json.hpp"
+#include "MdlToFbxConverter.h"
+
+// Every message, both ways, is one frame: the header's length and the body's length as little endian uint32s,
+// then a json header and the raw body.
+//
+// Request header:
+//   "id"        echoed back in the response, so responses can be matched to requests
+//   "type"      "convert" (default), "ping" or "shutdown"
+//   "mdl"       path of the mdl. If the body isn't empty it holds the mdl itself, and the path is only used for its
+//               file name, which is what face, hair and tail skeletons are found by.
+//   "output"    where to write the result. If missing, the files are sent back in the response body instead.
+//   "format"    "fbx" (default) or "glb"
+//   "lodMode"   as in ConvertToFbxWithLods
+//   "skeleton"  body skeleton to use instead of the server's default
+// A header that isn't an object, a field of the wrong type or out of range, or a header or body longer than the
+// server's maximum, fails that request only.
+// Response header:
+//   "id", "status" (0 or -1), "error" if it failed, "milliseconds", and "files": [{ "path", "size" }].
+//   Inline files follow each other in the body in the same order.
+struct ServerFrame {
+	nlohmann::json Header;
+	std::vector<char> Body;
+};
+
+// Long running converter that keeps an FBX SDK manager and scratch memory per worker, and the skeleton cache,
+// warm between requests. Requests are read on the calling thread and converted concurrently; responses are
+// written as each one finishes, so they can come back out of order.
+class ConverterServer
+{
+public:
+	// 0 workers uses one per core
+	ConverterServer(ExportOptions defaults = ExportOptions(), int workerCount = 0);
+
+	// Serves until the input ends or a shutdown request, then finishes every request already read.
+	// Returns the number of requests that failed.
+	int Serve(std::istream& in, std::ostream& out);
+
+	// Lengths come from the client, so anything longer is skipped rather than allocated
+	void SetMaxFrameLengths(uint32_t headerLength, uint32_t bodyLength);
+
+	static bool ReadFrame(std::istream& in, ServerFrame& frame, uint32_t maxHeaderLength = UINT32_MAX, uint32_t maxBodyLength = UINT32_MAX);
+	static void WriteFrame(std::ostream& out, const ServerFrame& frame);
+
+private:
+	ExportOptions defaults;
+	int workerCount;
+	uint32_t maxHeaderLength = 1024 * 1024;
+	// Far larger than any mdl
+	uint32_t maxBodyLength = 256 * 1024 * 1024;
+	std::mutex outputMutex;
+
+	ServerFrame HandleRequest(ServerFrame& request, FbxManager* manager, ScratchArena* arena, std::string tempDirectory);
+};
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "FbxMemoryStream.h"
+#include <cstring>
+#include <algorithm>
+
+FbxMemoryStream::FbxMemoryStream(FbxManager* manager, std::vector<char>& buffer) : buffer(buffer) {
+	writerId = manager->GetIOPluginRegistry()->FindWriterIDByDescription("FBX binary (*.fbx)");
+}
+
+FbxStream::EState FbxMemoryStream::GetState() {
+	return state;
+}
+
+bool FbxMemoryStream::Open(void* streamData) {
+	buffer.clear();
+	position = 0;
+	state = eOpen;
+	return true;
+}
+
+bool FbxMemoryStream::Close() {
+	state = eClosed;
+	return true;
+}
+
+bool FbxMemoryStream::Flush() {
+	return true;
+}
+
+size_t FbxMemoryStream::Write(const void* data, FbxUInt64 size) {
+	if (position + size > buffer.size()) {
+		buffer.resize(position + size);
+	}
+	memcpy(buffer.data() + position, data, size);
+	position += size;
+	return size;
+}
+
+size_t FbxMemoryStream::Read(void* data, FbxUInt64 size) const {
+	if (position >= buffer.size()) {
+		return 0;
+	}
+	size_t count = std::min((size_t)size, buffer.size() - position);
+	memcpy(data, buffer.data() + position, count);
+	position += count;
+	return count;
+}
+
+int FbxMemoryStream::GetReaderID() const {
+	return -1;
+}
+
+int FbxMemoryStream::GetWriterID() const {
+	return writerId;
+}
+
+void FbxMemoryStream::Seek(const FbxInt64& offset, const FbxFile::ESeekPos& seekPos) {
+	switch (seekPos) {
+	case FbxFile::eBegin:
+		position = offset;
+		break;
+	case FbxFile::eCurrent:
+		position += offset;
+		break;
+	case FbxFile::eEnd:
+		position = buffer.size() + offset;
+		break;
+	}
+}
+
+FbxInt64 FbxMemoryStream::GetPosition() const {
+	return position;
+}
+
+void FbxMemoryStream::SetPosition(FbxInt64 position) {
+	this->position = position;
+}
+
+int FbxMemoryStream::GetError() const {
+	return 0;
+}
+
+void FbxMemoryStream::ClearError() {
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include "fbxsdk.h"
+
+// Lets FbxExporter write into memory instead of a file, so the file itself can be written somewhere else
+class FbxMemoryStream : public FbxStream
+{
+public:
+	FbxMemoryStream(FbxManager* manager, std::vector<char>& buffer);
+
+	EState GetState() override;
+	bool Open(void* streamData) override;
+	bool Close() override;
+	bool Flush() override;
+	size_t Write(const void* data, FbxUInt64 size) override;
+	size_t Read(void* data, FbxUInt64 size) const override;
+	int GetReaderID() const override;
+	int GetWriterID() const override;
+	void Seek(const FbxInt64& offset, const FbxFile::ESeekPos& seekPos) override;
+	FbxInt64 GetPosition() const override;
+	void SetPosition(FbxInt64 position) override;
+	int GetError() const override;
+	void ClearError() override;
+
+private:
+	std::vector<char>& buffer;
+	mutable size_t position = 0;
+	EState state = eClosed;
+	int writerId;
+};
\ No newline at end of file
@@ -1,5 +1,14 @@
 #include "FbxToMdlConverter.h"
 #include <regex>
+#include "Instrumentation.h"
+#include "TangentGenerator.h"
+#include "VertexCacheOptimizer.h"
+#include "MeshSimplifier.h"
+#include "VertexTransform.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <bitset>
 #include <Models/Models/Model.h>
 #include <Models/Models/Vertex.h>
 
@@ -8,20 +17,92 @@
 const std::regex meshRegex(".*[_ ^][0-9]+[\\.\\-]?([0-9]+)?$");
 const std::regex extractMeshInfoRegex(".*[_ ^]([0-9]+)[\\.\\-]([0-9]+)$");
 
-std::map<int, std::map<int, FbxNode*>> groupPartToNode;
+FbxToMdlConverter::FbxToMdlConverter() {
+	manager = FbxManager::Create();
+	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+	manager->SetIOSettings(ios);
+}
 
+FbxToMdlConverter::~FbxToMdlConverter() {
+	DeleteImportedModels();
+	manager->Destroy();
+}
 
 int FbxToMdlConverter::ImportFbx(std::string fbxFilePath) {
-	fprintf(stdout, "Attempting to process fbx: %s\n", fbxFilePath.c_str());
+	Instrumentation::BeginReport(fbxFilePath);
+	int result = Import(fbxFilePath);
 
-	manager = FbxManager::Create();
-	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
-	manager->SetIOSettings(ios);
+	// The scene isn't kept, so the next import starts from an empty manager; the model, its lods and bounds stay until then
+	if (scene != NULL) {
+		scene->Destroy();
+		scene = NULL;
+	}
+	groupPartToNode.clear();
+	importedParts.clear();
+	BoneNames.clear();
+	arena->Release();
+	lastReport = Instrumentation::EndReport();
+	return result;
+}
+
+ConversionReport FbxToMdlConverter::GetLastReport() {
+	return lastReport;
+}
+
+Bounds FbxToMdlConverter::GetModelBounds() {
+	return modelBounds;
+}
+
+Bounds FbxToMdlConverter::GetMeshBounds(int meshIndex) {
+	if (meshIndex < 0 || meshIndex >= meshBounds.size()) {
+		return Bounds();
+	}
+	return meshBounds[meshIndex];
+}
+
+Model* FbxToMdlConverter::GetImportedModel() {
+	return importedModel;
+}
+
+Model* FbxToMdlConverter::GetGeneratedLod(int lod) {
+	if (lod < 1 || lod > generatedLods.size()) {
+		return NULL;
+	}
+	return generatedLods[lod - 1];
+}
+
+int FbxToMdlConverter::GetGeneratedLodCount() {
+	return generatedLods.size();
+}
+
+void FbxToMdlConverter::SetOptimizeVertexCache(bool optimize) {
+	optimizeVertexCache = optimize;
+}
+
+void FbxToMdlConverter::SetLodRatios(std::vector<float> ratios) {
+	lodRatios = ratios;
+}
+
+void FbxToMdlConverter::SetThreadCount(int count) {
+	threadCount = count;
+}
+
+void FbxToMdlConverter::SetArena(ScratchArena* externalArena) {
+	arena = externalArena != NULL ? externalArena : &ownedArena;
+}
+
+int FbxToMdlConverter::Import(std::string fbxFilePath) {
+	ScopedTimer timer("ImportFbx");
+	Instrumentation::Log(LogLevel::Info, "Attempting to process fbx: %s", fbxFilePath.c_str());
+	meshBounds.clear();
+	modelBounds = Bounds();
+	DeleteImportedModels();
 
 	FbxImporter* importer = FbxImporter::Create(manager, "");
 	bool success = importer->Initialize(fbxFilePath.c_str(), -1, manager->GetIOSettings());
 	if (!success) {
-		fprintf(stderr, "Could not load FBX file\n");
+		Instrumentation::Log(LogLevel::Error, "Could not load FBX file");
+		importer->Destroy();
 		return -1;
 	}
 
@@ -45,15 +126,40 @@ int FbxToMdlConverter::ImportFbx(std::string fbxFilePath) {
 
 	Model* model = new Model();
 
+	splitMeshes.clear();
+	nextMeshIndex = groupPartToNode.size();
 	for (int groupNum = 0; groupNum < groupPartToNode.size(); groupNum++) {
-		std::map<int, FbxNode*> partToNode = groupPartToNode[groupNum];
-		Mesh* group = new Mesh(groupNum);
+		std::map<int, FbxNode*>& partToNode = groupPartToNode[groupNum];
+		Mesh group(groupNum);
 		for (int partNum = 0; partNum < partToNode.size(); partNum++) {
-			SaveNode(group, partToNode[partNum], partNum);
+			SaveNode(&group, partToNode[partNum], partNum);
 		}
-		model->Meshes.push_back(*group);
+		model->Meshes.push_back(group);
+	}
+	if (splitMeshes.size() > 0) {
+		model->Meshes.insert(model->Meshes.end(), splitMeshes.begin(), splitMeshes.end());
+		splitMeshes.clear();
+		Instrumentation::AddCount("split_part_meshes", nextMeshIndex - groupPartToNode.size());
+		// Later passes expect the parts of each mesh together and in submesh order
+		std::stable_sort(importedParts.begin(), importedParts.end(), [](const ImportedPart& a, const ImportedPart& b) {
+			return a.MeshIndex < b.MeshIndex;
+		});
 	}
+	BuildBoneTables(model);
+	Instrumentation::AddCount("meshes", model->Meshes.size());
 
+	meshBounds.assign(model->Meshes.size(), Bounds());
+	for (int i = 0; i < importedParts.size(); i++) {
+		meshBounds[importedParts[i].MeshIndex].Add(importedParts[i].PartBounds);
+		modelBounds.Add(importedParts[i].PartBounds);
+	}
+	if (!modelBounds.IsEmpty()) {
+		Instrumentation::Log(LogLevel::Debug, "Model bounds (%.3f, %.3f, %.3f) - (%.3f, %.3f, %.3f)",
+			modelBounds.Min[0], modelBounds.Min[1], modelBounds.Min[2], modelBounds.Max[0], modelBounds.Max[1], modelBounds.Max[2]);
+	}
+	GenerateLods(model);
+
+	importedModel = model;
 	return 0;
 }
 
@@ -92,7 +198,7 @@ void FbxToMdlConverter::IterateNode(FbxNode* pNode) {
 				group->second.emplace(partNum, pNode);
 			}
 			else {
-				fprintf(stderr, "Mesh %i.%i already exists.\n", meshNum, partNum);
+				Instrumentation::Log(LogLevel::Warning, "Mesh %i.%i already exists.", meshNum, partNum);
 				return;
 			}
 		}
@@ -122,38 +228,194 @@ static bool NearlyEqual(FbxVector4 a, FbxVector4 b) {
 	return true;
 }
 
-void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex) {
+// Point in triangle on the projected plane, counting points on an edge as inside so touching vertices block an ear
+static bool InTriangle(double px, double py, double ax, double ay, double bx, double by, double cx, double cy, double sign) {
+	double d1 = ((bx - ax) * (py - ay) - (by - ay) * (px - ax)) * sign;
+	double d2 = ((cx - bx) * (py - by) - (cy - by) * (px - bx)) * sign;
+	double d3 = ((ax - cx) * (py - cy) - (ay - cy) * (px - cx)) * sign;
+	return d1 >= 0 && d2 >= 0 && d3 >= 0;
+}
+
+// Projects an n-gon onto the axis plane its Newell normal is closest to and clips ears off it, keeping the original winding.
+// Anything too broken for that (self intersecting, degenerate) is finished off as a fan.
+static void EarClipPolygon(const int* polygonVertices, const FbxVector4* controlPoints, int start, int size, std::pmr::vector<int>& remaining, std::pmr::vector<int>& corners) {
+	double normal[3] = { 0, 0, 0 };
+	for (int i = 0; i < size; i++) {
+		const FbxVector4& cur = controlPoints[polygonVertices[start + i]];
+		const FbxVector4& next = controlPoints[polygonVertices[start + (i + 1) % size]];
+		normal[0] += (cur[1] - next[1]) * (cur[2] + next[2]);
+		normal[1] += (cur[2] - next[2]) * (cur[0] + next[0]);
+		normal[2] += (cur[0] - next[0]) * (cur[1] + next[1]);
+	}
+	int axis = 0;
+	if (std::abs(normal[1]) > std::abs(normal[axis])) axis = 1;
+	if (std::abs(normal[2]) > std::abs(normal[axis])) axis = 2;
+	int u = (axis + 1) % 3;
+	int v = (axis + 2) % 3;
+	// Counter clockwise around the normal has a positive area on this projection
+	double sign = normal[axis] >= 0 ? 1.0 : -1.0;
+
+	remaining.clear();
+	for (int i = 0; i < size; i++) {
+		remaining.push_back(i);
+	}
+
+	size_t i = 0;
+	size_t sinceLastEar = 0;
+	while (remaining.size() > 3 && sinceLastEar <= remaining.size()) {
+		size_t n = remaining.size();
+		int a = remaining[(i + n - 1) % n];
+		int b = remaining[i];
+		int c = remaining[(i + 1) % n];
+		const FbxVector4& pa = controlPoints[polygonVertices[start + a]];
+		const FbxVector4& pb = controlPoints[polygonVertices[start + b]];
+		const FbxVector4& pc = controlPoints[polygonVertices[start + c]];
+
+		double cross = ((pb[u] - pa[u]) * (pc[v] - pa[v]) - (pb[v] - pa[v]) * (pc[u] - pa[u])) * sign;
+		bool ear = cross > 0;
+		for (size_t k = 0; ear && k < n; k++) {
+			int other = remaining[k];
+			if (other == a || other == b || other == c) continue;
+			const FbxVector4& p = controlPoints[polygonVertices[start + other]];
+			if (InTriangle(p[u], p[v], pa[u], pa[v], pb[u], pb[v], pc[u], pc[v], sign)) {
+				ear = false;
+			}
+		}
+
+		if (ear) {
+			corners.push_back(start + a);
+			corners.push_back(start + b);
+			corners.push_back(start + c);
+			remaining.erase(remaining.begin() + i);
+			i = i % (n - 1);
+			sinceLastEar = 0;
+		}
+		else {
+			i = (i + 1) % n;
+			sinceLastEar++;
+		}
+	}
+
+	for (size_t k = 1; k + 1 < remaining.size(); k++) {
+		corners.push_back(start + remaining[0]);
+		corners.push_back(start + remaining[k]);
+		corners.push_back(start + remaining[k + 1]);
+	}
+}
+
+
+// Cheap checks over the polygon sizes and layers, so a bad mesh is rejected before SaveNode allocates anything.
+// triangleCorners is how many indices the mesh will have once it is triangulated.
+bool FbxToMdlConverter::ValidateMesh(FbxNode* node, int& triangleCorners) {
 	FbxMesh* mesh = node->GetMesh();
+	triangleCorners = 0;
+	if (mesh == NULL) {
+		Instrumentation::Log(LogLevel::Warning, "%s does not have a mesh", node->GetName());
+		return false;
+	}
 
-	int numVertices = mesh->GetControlPointsCount();
-	int numIndices = mesh->GetPolygonVertexCount();
-	if (numIndices == 0 || numVertices == 0) {
+	int polygonCount = mesh->GetPolygonCount();
+	if (mesh->GetControlPointsCount() == 0 || polygonCount == 0) {
 		// Mesh does not actually have any tris.
-		fprintf(stderr, "Mesh has no vertices/trianges\n");
-		return;
+		Instrumentation::Log(LogLevel::Warning, "Mesh has no vertices/trianges");
+		return false;
 	}
 
-	FbxSkin* skin = GetSkin(mesh);
-	if (skin == NULL) {
+	for (int p = 0; p < polygonCount; p++) {
+		int size = mesh->GetPolygonSize(p);
+		if (size < 3) {
+			Instrumentation::Log(LogLevel::Error, "%s has a polygon with only %i vertices", node->GetName(), size);
+			return false;
+		}
+		triangleCorners += (size - 2) * 3;
+	}
+
+	FbxLayer* layer = mesh->GetLayerCount() > 0 ? mesh->GetLayer(0) : NULL;
+	if (layer == NULL || layer->GetNormals() == NULL) {
+		Instrumentation::Log(LogLevel::Warning, "%s has no normals", node->GetName());
+	}
+	if (layer == NULL || layer->GetUVs() == NULL) {
+		Instrumentation::Log(LogLevel::Warning, "%s has no uvs", node->GetName());
+	}
+	if (GetSkin(mesh) == NULL) {
 		// Mesh does not actually have a skin.
-		fprintf(stderr, "Mesh does not have a valid skin element. Armature?\n");
+		Instrumentation::Log(LogLevel::Warning, "Mesh does not have a valid skin element. Armature?");
 	}
+	return true;
+}
 
-	// TODO: BoneTable...
-	std::map<std::string, uint16_t> boneNameToBoneTableIndex;
-	std::map<int, std::vector<Weight>> weights;
+// Triangles go in as they are, quads are split along their shorter diagonal, and anything bigger is ear clipped.
+// corners gets the polygon vertex index of every triangle corner, so the layers can still be looked up per corner.
+void FbxToMdlConverter::TriangulateMesh(FbxMesh* mesh, std::pmr::vector<int>& corners) {
+	ScopedTimer timer("Triangulate");
+	const int* polygonVertices = mesh->GetPolygonVertices();
+	const FbxVector4* controlPoints = mesh->GetControlPoints();
+	std::pmr::vector<int> remaining(arena);
+	int triangulated = 0;
+
+	for (int p = 0; p < mesh->GetPolygonCount(); p++) {
+		int start = mesh->GetPolygonVertexIndex(p);
+		int size = mesh->GetPolygonSize(p);
+
+		if (size == 3) {
+			corners.push_back(start);
+			corners.push_back(start + 1);
+			corners.push_back(start + 2);
+			continue;
+		}
+		triangulated++;
+
+		if (size == 4) {
+			FbxVector4 diagonal02 = controlPoints[polygonVertices[start + 2]] - controlPoints[polygonVertices[start]];
+			FbxVector4 diagonal13 = controlPoints[polygonVertices[start + 3]] - controlPoints[polygonVertices[start + 1]];
+			int first = diagonal02.SquareLength() <= diagonal13.SquareLength() ? 0 : 1;
+			corners.push_back(start + first);
+			corners.push_back(start + first + 1);
+			corners.push_back(start + first + 2);
+			corners.push_back(start + first);
+			corners.push_back(start + first + 2);
+			corners.push_back(start + (first + 3) % 4);
+		}
+		else {
+			EarClipPolygon(polygonVertices, controlPoints, start, size, remaining, corners);
+		}
+	}
 
-	// Vector of [control point index] => [Set of tri indexes that reference it.
-	std::vector<std::vector<int>> controlToPolyArray;
-	controlToPolyArray.resize(mesh->GetControlPointsCount());
-	int polys = mesh->GetPolygonCount();
-	if (polys != (numIndices / 3.0f)) {
-		fprintf(stderr, "FBX is not fully triangulated.\n");
+	if (triangulated > 0) {
+		Instrumentation::Log(LogLevel::Debug, "Triangulated %i polygons", triangulated);
+		Instrumentation::AddCount("triangulated_polygons", triangulated);
+	}
+}
+
+void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex) {
+	ScopedTimer timer("SaveNode");
+	FbxMesh* mesh = node->GetMesh();
+
+	int numIndices = 0;
+	// Everything that would make the mesh unusable is found before anything big is allocated
+	if (!ValidateMesh(node, numIndices)) {
 		return;
 	}
+	int numVertices = mesh->GetControlPointsCount();
+
+	// Polygon vertex index of each triangle corner; this is what the layer lookups take
+	std::pmr::vector<int> corners(arena);
+	corners.reserve(numIndices);
+	TriangulateMesh(mesh, corners);
+	numIndices = corners.size();
+	const int* polygonVertices = mesh->GetPolygonVertices();
+
+	FbxSkin* skin = GetSkin(mesh);
 
+	// Weights refer to BoneNames; vertices refer to partBones, which is turned into the mesh's bone table later
+	std::pmr::map<int, std::pmr::vector<Weight>> weights(arena);
+	std::pmr::vector<int> partBones(arena);
+
+	// Vector of [control point index] => [Set of tri indexes that reference it.
+	std::pmr::vector<std::pmr::vector<int>> controlToPolyArray(arena);
+	controlToPolyArray.resize(mesh->GetControlPointsCount());
 	for (int i = 0; i < numIndices; i++) {
-		int controlPointIndex = mesh->GetPolygonVertex(i / 3, i % 3);
+		int controlPointIndex = polygonVertices[corners[i]];
 		controlToPolyArray[controlPointIndex].push_back(i);
 	}
 
@@ -170,7 +432,7 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 				BoneNames.push_back(name);
 			}
 			else {
-				boneIdx = it->npos;
+				boneIdx = it - BoneNames.begin();
 			}
 
 			int affectedVertCount = skin->GetCluster(i)->GetControlPointIndicesCount();
@@ -180,10 +442,38 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 				int cpIndex = skin->GetCluster(i)->GetControlPointIndices()[vi];
 				double weight = skin->GetCluster(i)->GetControlPointWeights()[vi];
 
-				// TODO: This currently allows more than four weights to be added (when xivmdls can only reference four bones)
 				weights[cpIndex].push_back(Weight(boneIdx, weight));
 			}
 		}
+
+		// A vertex can only reference four bones: keep the strongest and make them add up to one again
+		std::pmr::vector<int> globalToPart(BoneNames.size(), -1, arena);
+		for (auto it = weights.begin(); it != weights.end(); it++) {
+			std::pmr::vector<Weight>& weightSet = it->second;
+			std::sort(weightSet.begin(), weightSet.end(), [](const Weight& a, const Weight& b) { return a.Value > b.Value; });
+			if (weightSet.size() > 4) {
+				weightSet.resize(4, Weight(0, 0));
+			}
+			double total = 0;
+			for (int w = 0; w < weightSet.size(); w++) {
+				total += weightSet[w].Value;
+			}
+			for (int w = 0; w < weightSet.size(); w++) {
+				if (total > 0) {
+					weightSet[w].Value /= total;
+				}
+				int& partBone = globalToPart[weightSet[w].BoneIndex];
+				if (partBone == -1) {
+					partBone = partBones.size();
+					partBones.push_back(weightSet[w].BoneIndex);
+				}
+				weightSet[w].BoneIndex = partBone;
+			}
+		}
+		if (partBones.size() > 256) {
+			Instrumentation::Log(LogLevel::Error, "%s references %i bones, a part can only use 256", node->GetName(), (int)partBones.size());
+			return;
+		}
 	}
 
 	FbxBlendShape* morpher = GetMorpher(mesh);
@@ -218,7 +508,7 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 						continue;
 					}
 					else if (shapeCount > 1) {
-						fprintf(stderr, "Invalid shape channel. Skipping.\n");
+						Instrumentation::Log(LogLevel::Warning, "Invalid shape channel. Skipping.");
 						continue;
 					}
 
@@ -232,7 +522,7 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 						if (pct == 0.0) {
 							continue;
 						}
-						fprintf(stdout, "Applying blend shape %s\n", name.c_str());
+						Instrumentation::Log(LogLevel::Debug, "Applying blend shape %s", name.c_str());
 						anyActiveBlends = true;
 
 						for (int k = 0; k < vertexCount; k++) {
@@ -261,8 +551,8 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 	}
 
 
-	std::vector<std::string> shapeNames;
-	std::map<std::string, std::map<int, Vertex>> shapeVertices;
+	std::pmr::vector<std::pmr::string> shapeNames(arena);
+	std::pmr::map<std::pmr::string, std::pmr::map<int, Vertex>> shapeVertices(arena);
 	// Handle "shp_" deformations
 	for (int i = 0; i < deformerCount; i++) {
 		FbxDeformer* d = mesh->GetDeformer(i);
@@ -281,7 +571,7 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 						continue;
 					}
 					else if (shapeCount > 1) {
-						fprintf(stderr, "%s contains invalid shape channel\n", node->GetName());
+						Instrumentation::Log(LogLevel::Warning, "%s contains invalid shape channel", node->GetName());
 						continue;
 					}
 
@@ -295,11 +585,11 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 						}
 
 						if (skip) {
-							fprintf(stderr, "Shape name: %s is included more than once.\n", name.c_str());
+							Instrumentation::Log(LogLevel::Warning, "Shape name: %s is included more than once.", name.c_str());
 							continue;
 						}
 
-						shapeNames.push_back(name);
+						shapeNames.emplace_back(name);
 						for (int j = 0; j < vertexCount; j++) {
 							auto shapeVert = fbxShape->GetControlPointAt(j);
 							auto baseVert = mesh->GetControlPointAt(j);
@@ -311,10 +601,11 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 								for (int k = 0; k < 4; k++) {
 									sVert.Position[k] = worldPos.mData[k];
 								}
-								if (shapeVertices.find(name) == shapeVertices.end()) {
-									shapeVertices.emplace(name, std::map<int, Vertex>());
+								auto shapeIt = shapeVertices.find(std::pmr::string(name, arena));
+								if (shapeIt == shapeVertices.end()) {
+									shapeIt = shapeVertices.emplace(std::pmr::string(name, arena), std::pmr::map<int, Vertex>(arena)).first;
 								}
-								shapeVertices[name].insert({ j, sVert });
+								shapeIt->second.insert({ j, sVert });
 							}
 						}
 					}
@@ -323,10 +614,39 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 		}
 	}
 
-	std::vector<Vertex> vertices;
-	std::vector<int> triIndices;
+	// Every corner's position and normal, moved into world space in one batch that also finds the part's bounds
+	std::pmr::vector<float> cornerData(numIndices * 6, arena);
+	VertexArrays world = { cornerData.data(), cornerData.data() + numIndices, cornerData.data() + numIndices * 2,
+		cornerData.data() + numIndices * 3, cornerData.data() + numIndices * 4, cornerData.data() + numIndices * 5, (size_t)numIndices };
+	for (int i = 0; i < numIndices; i++) {
+		FbxVector4 position = GetPosition(mesh, corners[i]);
+		FbxVector4 normal = GetNormal(mesh, corners[i]);
+		world.X[i] = position[0];
+		world.Y[i] = position[1];
+		world.Z[i] = position[2];
+		world.NX[i] = normal[0];
+		world.NY[i] = normal[1];
+		world.NZ[i] = normal[2];
+	}
+	float worldMatrix[16];
+	float normalMatrix[16];
+	for (int r = 0; r < 4; r++) {
+		for (int c = 0; c < 4; c++) {
+			worldMatrix[r * 4 + c] = (float)worldTransform.Get(r, c);
+			normalMatrix[r * 4 + c] = (float)normalMatri.Get(r, c);
+		}
+	}
+	Bounds partBounds;
+	{
+		ScopedTimer transformTimer("TransformVertices");
+		VertexTransform::Transform(worldMatrix, normalMatrix, world, partBounds);
+	}
+
+	std::pmr::vector<Vertex> vertices(arena);
+	std::pmr::vector<int> triIndices(arena);
 	triIndices.resize(numIndices);
-	std::map<int, std::vector<int>> controlPointToVertexMapping;
+	std::pmr::map<int, std::pmr::vector<int>> controlPointToVertexMapping(arena);
+	std::pmr::vector<Vertex> sharedVerts(arena);
 
 	for (int cpi = 0; cpi < controlToPolyArray.size(); cpi++) {
 		int sharedIndexCount = controlToPolyArray[cpi].size();
@@ -336,33 +656,29 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 			continue;
 		}
 
-		std::vector<Vertex> sharedVerts;
+		sharedVerts.clear();
 		for (int ti = 0; ti < sharedIndexCount; ti++) {
 			Vertex myVert = Vertex();
 			int indexId = controlToPolyArray[cpi][ti];
+			int polygonVertex = corners[indexId];
 
-			auto vertWorldPosition = worldTransform.MultT(GetPosition(mesh, indexId));
-			auto vertWorldNormal = normalMatri.MultT(GetNormal(mesh, indexId));
-			auto localNormal = GetNormal(mesh, indexId);
-			vertWorldNormal.Normalize();
-
-			auto vertexColor = GetVertexColor(mesh, indexId);
+			auto vertexColor = GetVertexColor(mesh, polygonVertex);
 
-			for (int i = 0; i < 4; i++) {
-				myVert.Position[i] = vertWorldPosition.mData[i];
-
-				if (i != 3) {
-					myVert.Normal[i] = vertWorldNormal.mData[i];
-				}
-			}
+			myVert.Position[0] = world.X[indexId];
+			myVert.Position[1] = world.Y[indexId];
+			myVert.Position[2] = world.Z[indexId];
+			myVert.Position[3] = 1.0f;
+			myVert.Normal[0] = world.NX[indexId];
+			myVert.Normal[1] = world.NY[indexId];
+			myVert.Normal[2] = world.NZ[indexId];
 
 			myVert.Color[0] = vertexColor.mRed;
 			myVert.Color[1] = vertexColor.mGreen;
 			myVert.Color[2] = vertexColor.mBlue;
 			myVert.Color[3] = vertexColor.mAlpha;
 
-			auto uv1 = GetUV1(mesh, indexId);
-			auto uv2 = GetUV2(mesh, indexId);
+			auto uv1 = GetUV1(mesh, polygonVertex);
+			auto uv2 = GetUV2(mesh, polygonVertex);
 
 			// Guess we have to flip the "v" value
 			myVert.UV[0] = uv1[0];
@@ -370,20 +686,20 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 			myVert.UV[2] = uv2[0];
 			myVert.UV[3] = -uv2[1];
 
-			// TODO: BlendIndices
-			// TODO: Bone names seem to be sorted alphabetically
-			std::vector<Weight> weightSet = weights[cpi];
+			// BlendIndices point into partBones until BuildBoneTables gives the mesh its bone table
+			std::pmr::vector<Weight>& weightSet = weights[cpi];
 			for (int i = 0; i < 4; i++) {
 				if (weightSet.size() > i) {
 					myVert.BlendWeights[i] = weightSet[i].Value;
+					myVert.BlendIndices[i] = weightSet[i].BoneIndex;
 				}
 				else {
 					myVert.BlendWeights[i] = 0;
+					myVert.BlendIndices[i] = 0;
 				}
 			}
 
-			// TODO: Tangent2?
-			// TODO: Tangent1... Calculate tangents...?
+			// Tangent1 and Tangent2 are filled in once the part's vertices are all built
 
 			int sharedVertToUse = -1;
 			for (int svi = 0; svi < sharedVerts.size(); svi++) {
@@ -406,7 +722,7 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 		}
 
 		vertices.resize(oldSize + sharedVerts.size());
-		controlPointToVertexMapping.insert({ cpi, std::vector<int>() });
+		controlPointToVertexMapping.emplace(cpi, std::pmr::vector<int>(arena));
 		for (int svi = 0; svi < sharedVerts.size(); svi++) {
 			vertices[oldSize + svi] = sharedVerts[svi];
 			controlPointToVertexMapping[cpi].push_back(oldSize + svi);
@@ -414,10 +730,10 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 	}
 
 	for (auto sName = shapeVertices.begin(); sName != shapeVertices.end(); sName++) {
-		std::map<int, Vertex> newMapping;
+		std::pmr::map<int, Vertex> newMapping(arena);
 		for (auto newIt = sName->second.begin(); newIt != sName->second.end(); newIt++) {
 			auto cpi = newIt->first;
-			auto arr = controlPointToVertexMapping[cpi];
+			auto& arr = controlPointToVertexMapping[cpi];
 			for (int i = 0; i < arr.size(); i++) {
 				newMapping.insert({ arr[i], newIt->second });
 			}
@@ -425,29 +741,443 @@ void FbxToMdlConverter::SaveNode(Mesh* parent, FbxNode* node, int subMeshIndex)
 		sName->second = newMapping;
 	}
 
-	Submesh child = Submesh();
+	// Before the cache optimisation, so the vertices tangent spaces split off get ordered with the rest.
+	// A split off copy moves with its shapes like the vertex it came from.
+	if (vertices.size() > 0) {
+		ScopedTimer tangentTimer("GenerateTangents");
+		size_t originalCount = vertices.size();
+		std::pmr::vector<int> splitFrom(arena);
+		TangentGenerator::Generate(vertices, triIndices, splitFrom);
+		for (auto sName = shapeVertices.begin(); sName != shapeVertices.end(); sName++) {
+			for (int i = 0; i < splitFrom.size(); i++) {
+				auto it = sName->second.find(splitFrom[i]);
+				if (it != sName->second.end()) {
+					Vertex shapeVertex = it->second;
+					sName->second.insert({ (int)(originalCount + i), shapeVertex });
+				}
+			}
+		}
+		Instrumentation::AddCount("tangent_vertices", vertices.size());
+		Instrumentation::AddCount("tangent_split_vertices", splitFrom.size());
+	}
 
-	child.IndexOffset = parent->Indices.size();
-	child.IndexNum = triIndices.size();
+	if (optimizeVertexCache && vertices.size() > 0) {
+		ScopedTimer optimizeTimer("OptimizeVertexCache");
+		int missesBefore = VertexCacheOptimizer::CountCacheMisses(triIndices.data(), triIndices.size(), vertices.size());
+		VertexCacheOptimizer::OptimizeTriangleOrder(triIndices.data(), triIndices.size(), vertices.size(), arena);
+		std::pmr::vector<int> oldToNew(arena);
+		VertexCacheOptimizer::OptimizeVertexOrder(triIndices.data(), triIndices.size(), vertices.size(), oldToNew);
+		int missesAfter = VertexCacheOptimizer::CountCacheMisses(triIndices.data(), triIndices.size(), vertices.size());
+
+		// Skin weights move with their vertices; shapes are keyed by vertex, so they are moved the same way
+		std::pmr::vector<Vertex> reordered(vertices.size(), arena);
+		for (int v = 0; v < vertices.size(); v++) {
+			reordered[oldToNew[v]] = vertices[v];
+		}
+		vertices.swap(reordered);
+		for (auto sName = shapeVertices.begin(); sName != shapeVertices.end(); sName++) {
+			std::pmr::map<int, Vertex> newMapping(arena);
+			for (auto it = sName->second.begin(); it != sName->second.end(); it++) {
+				newMapping.insert({ oldToNew[it->first], it->second });
+			}
+			sName->second = newMapping;
+		}
 
-	parent->Vertices.insert(parent->Vertices.end(), vertices.begin(), vertices.end());
-	parent->Indices.insert(parent->Indices.end(), triIndices.begin(), triIndices.end());
-	parent->Submeshes.push_back(child);
+		double triangles = triIndices.size() / 3.0;
+		Instrumentation::Log(LogLevel::Info, "%s ACMR %.3f -> %.3f", node->GetName(), missesBefore / triangles, missesAfter / triangles);
+		Instrumentation::AddCount("triangles", triIndices.size() / 3);
+		Instrumentation::AddCount("cache_misses_before", missesBefore);
+		Instrumentation::AddCount("cache_misses_after", missesAfter);
+	}
 
-	for (auto sName = shapeVertices.begin(); sName != shapeVertices.end(); sName++) {
-		uint16_t startIndex[3] = { parent->Vertices.size(), 0, 0 };
-		// TODO: What is meshCount?
-		uint16_t meshCount[3] = { 0,0,0 };
-		Shape s(sName->first, startIndex, meshCount);
-		auto& mapping = sName->second;
-		for (auto it = mapping.begin(); it != mapping.end(); it++) {
-			parent->Vertices.push_back(it->second);
+	// Mesh indices are stored as 16 bit and bone tables are limited, so a part with more vertices or bones than that becomes several parts
+	std::pmr::vector<PartChunk> chunks(arena);
+	int partVertexCount = vertices.size();
+	SplitPart(vertices, triIndices, shapeVertices, partBones, chunks);
+	if (chunks.size() > 1) {
+		Instrumentation::Log(LogLevel::Warning, "%s has %i vertices and %i bones, split into %i parts", node->GetName(), partVertexCount, (int)partBones.size(), (int)chunks.size());
+		Instrumentation::AddCount("split_parts", chunks.size() - 1);
+	}
+
+	Mesh* original = parent;
+	for (int c = 0; c < chunks.size(); c++) {
+		PartChunk& chunk = chunks[c];
+		// Submesh indices are relative to the start of the mesh's vertex buffer, which holds shape vertices too, so a chunk
+		// that would take the mesh past what 16 bit indices reach gets a new mesh with the same material.
+		size_t chunkVertices = chunk.Vertices.size();
+		for (auto sName = chunk.ShapeVertices.begin(); sName != chunk.ShapeVertices.end(); sName++) {
+			chunkVertices += sName->second.size();
+		}
+		parent = original;
+		if (original->Vertices.size() > 0 && original->Vertices.size() + chunkVertices > MaxPartVertices) {
+			Mesh split = *original;
+			split.MeshIndex = nextMeshIndex++;
+			split.Vertices.clear();
+			split.Indices.clear();
+			split.Submeshes.clear();
+			splitMeshes.push_back(split);
+			parent = &splitMeshes.back();
+		}
+		Submesh child = Submesh();
+
+		child.IndexOffset = parent->Indices.size();
+		child.IndexNum = chunk.Indices.size();
+
+		ImportedPart imported;
+		imported.MeshIndex = parent->MeshIndex;
+		imported.IndexOffset = child.IndexOffset;
+		imported.IndexCount = child.IndexNum;
+		imported.VertexOffset = parent->Vertices.size();
+		imported.VertexCount = chunk.Vertices.size();
+		imported.Bones.assign(partBones.begin(), partBones.end());
+		// The whole part's bounds, which still contain each chunk of it
+		imported.PartBounds = partBounds;
+		for (auto sName = chunk.ShapeVertices.begin(); sName != chunk.ShapeVertices.end(); sName++) {
+			for (auto it = sName->second.begin(); it != sName->second.end(); it++) {
+				imported.ShapeVertices.push_back(it->first);
+			}
 		}
+		importedParts.push_back(imported);
 
+		parent->Vertices.insert(parent->Vertices.end(), chunk.Vertices.begin(), chunk.Vertices.end());
+		for (int i = 0; i < chunk.Indices.size(); i++) {
+			parent->Indices.push_back(chunk.Indices[i] + imported.VertexOffset);
+		}
+		parent->Submeshes.push_back(child);
+
+		Instrumentation::AddCount("vertices", chunk.Vertices.size());
+		Instrumentation::AddCount("indices", chunk.Indices.size());
+		Instrumentation::AddCount("shapes", chunk.ShapeVertices.size());
+
+		for (auto sName = chunk.ShapeVertices.begin(); sName != chunk.ShapeVertices.end(); sName++) {
+			// Shapes start after every vertex in the mesh, which can be past what the 16 bit field holds
+			uint32_t shapeStart = parent->Vertices.size();
+			if (shapeStart > UINT16_MAX) {
+				Instrumentation::Log(LogLevel::Warning, "Shape %s starts at vertex %u, past the 16 bit limit. Skipping.", sName->first.c_str(), shapeStart);
+				continue;
+			}
+			uint16_t startIndex[3] = { (uint16_t)shapeStart, 0, 0 };
+			// TODO: What is meshCount?
+			uint16_t meshCount[3] = { 0,0,0 };
+			Shape s(std::string(sName->first.c_str()), startIndex, meshCount);
+			auto& mapping = sName->second;
+			for (auto it = mapping.begin(); it != mapping.end(); it++) {
+				parent->Vertices.push_back(it->second);
+			}
+
+		}
 	}
 
 	// TODO: Add shapes
-	// TODO: Add bones
+	// TODO: Add the bone names to the model
+}
+
+// Bits of the part bones a vertex is weighted to
+static void AddVertexBones(const Vertex& v, std::bitset<256>& bones) {
+	for (int w = 0; w < 4; w++) {
+		if (v.BlendWeights[w] > 0) {
+			bones.set(v.BlendIndices[w]);
+		}
+	}
+}
+
+// Cuts a part into runs of whole triangles that each reference at most MaxPartVertices vertices and MaxBoneTableSize bones.
+// Triangles keep their order, so a cache optimised part stays optimised; vertices used on both sides of a cut are duplicated.
+void FbxToMdlConverter::SplitPart(std::pmr::vector<Vertex>& vertices, std::pmr::vector<int>& triIndices,
+	std::pmr::map<std::pmr::string, std::pmr::map<int, Vertex>>& shapeVertices, const std::pmr::vector<int>& partBones,
+	std::pmr::vector<PartChunk>& chunks) {
+	if (vertices.size() <= MaxPartVertices && partBones.size() <= MaxBoneTableSize) {
+		chunks.emplace_back(arena);
+		chunks.back().Vertices.swap(vertices);
+		chunks.back().Indices.swap(triIndices);
+		chunks.back().ShapeVertices.swap(shapeVertices);
+		return;
+	}
+
+	ScopedTimer timer("SplitPart");
+	std::pmr::vector<int> partToChunk(vertices.size(), -1, arena);
+	std::pmr::vector<int> chunkToPart(arena);
+	std::bitset<256> chunkBones;
+	size_t triangleStart = 0;
+	for (size_t i = 0; i <= triIndices.size(); i += 3) {
+		int added = 0;
+		std::bitset<256> withTriangle = chunkBones;
+		if (i < triIndices.size()) {
+			for (int k = 0; k < 3; k++) {
+				if (partToChunk[triIndices[i + k]] == -1) added++;
+				AddVertexBones(vertices[triIndices[i + k]], withTriangle);
+			}
+		}
+		if (i < triIndices.size() && chunkToPart.size() + added <= MaxPartVertices && withTriangle.count() <= MaxBoneTableSize) {
+			chunkBones = withTriangle;
+			for (int k = 0; k < 3; k++) {
+				int& mapped = partToChunk[triIndices[i + k]];
+				if (mapped == -1) {
+					mapped = chunkToPart.size();
+					chunkToPart.push_back(triIndices[i + k]);
+				}
+			}
+			continue;
+		}
+
+		// The triangle doesn't fit, or this is the end of the part: close the current chunk
+		chunks.emplace_back(arena);
+		PartChunk& chunk = chunks.back();
+		chunk.Vertices.reserve(chunkToPart.size());
+		for (int v = 0; v < chunkToPart.size(); v++) {
+			chunk.Vertices.push_back(vertices[chunkToPart[v]]);
+		}
+		chunk.Indices.reserve(i - triangleStart);
+		for (size_t t = triangleStart; t < i; t++) {
+			chunk.Indices.push_back(partToChunk[triIndices[t]]);
+		}
+		for (auto sName = shapeVertices.begin(); sName != shapeVertices.end(); sName++) {
+			std::pmr::map<int, Vertex> mapping(arena);
+			for (auto it = sName->second.begin(); it != sName->second.end(); it++) {
+				if (partToChunk[it->first] != -1) {
+					mapping.insert({ partToChunk[it->first], it->second });
+				}
+			}
+			if (mapping.size() > 0) {
+				chunk.ShapeVertices.emplace(sName->first, std::move(mapping));
+			}
+		}
+
+		for (int v = 0; v < chunkToPart.size(); v++) {
+			partToChunk[chunkToPart[v]] = -1;
+		}
+		chunkToPart.clear();
+		chunkBones.reset();
+		triangleStart = i;
+		// Step back so the triangle that didn't fit starts the next chunk
+		if (i < triIndices.size()) {
+			i -= 3;
+		}
+	}
+}
+
+// Gives every mesh the smallest bone table that covers what its parts are weighted to, and points BlendIndices into it.
+// When the parts of a mesh need more bones than a table holds, the ones that don't fit are moved to new meshes
+// with the same material. Shape vertices of a mesh that is split up are not carried over.
+void FbxToMdlConverter::BuildBoneTables(Model* model) {
+	ScopedTimer timer("BuildBoneTables");
+	int words = (BoneNames.size() + 63) / 64;
+
+	// Bones each part's weights use, as bitsets over BoneNames
+	std::vector<std::vector<uint64_t>> partUses(importedParts.size(), std::vector<uint64_t>(words, 0));
+	for (int p = 0; p < importedParts.size(); p++) {
+		ImportedPart& part = importedParts[p];
+		Mesh& group = model->Meshes[part.MeshIndex];
+		for (int v = 0; v < part.VertexCount; v++) {
+			Vertex& vertex = group.Vertices[part.VertexOffset + v];
+			for (int w = 0; w < 4; w++) {
+				if (vertex.BlendWeights[w] > 0) {
+					int bone = part.Bones[vertex.BlendIndices[w]];
+					partUses[p][bone / 64] |= 1ULL << (bone % 64);
+				}
+			}
+		}
+	}
+
+	auto countBones = [](const std::vector<uint64_t>& bits) {
+		size_t count = 0;
+		for (int i = 0; i < bits.size(); i++) {
+			count += std::bitset<64>(bits[i]).count();
+		}
+		return count;
+	};
+
+	std::vector<int> globalToTable(BoneNames.size(), 0);
+	int meshCount = model->Meshes.size();
+	int addedMeshes = 0;
+	for (int m = 0; m < meshCount; m++) {
+		// Parts in submesh order, packed into as few tables as will hold them without reordering
+		std::vector<int> parts;
+		for (int p = 0; p < importedParts.size(); p++) {
+			if (importedParts[p].MeshIndex == m) {
+				parts.push_back(p);
+			}
+		}
+		std::vector<std::vector<int>> tableParts(1);
+		std::vector<std::vector<uint64_t>> tableUses(1, std::vector<uint64_t>(words, 0));
+		for (int i = 0; i < parts.size(); i++) {
+			std::vector<uint64_t> merged = tableUses.back();
+			for (int word = 0; word < words; word++) {
+				merged[word] |= partUses[parts[i]][word];
+			}
+			if (countBones(merged) > MaxBoneTableSize && tableParts.back().size() > 0) {
+				tableParts.emplace_back();
+				tableUses.push_back(partUses[parts[i]]);
+			}
+			else {
+				tableUses.back() = merged;
+			}
+			tableParts.back().push_back(parts[i]);
+		}
+
+		if (tableParts.size() > 1) {
+			Instrumentation::Log(LogLevel::Warning, "Mesh %i uses more than %i bones, splitting it into %i meshes", m, MaxBoneTableSize, (int)tableParts.size());
+			Mesh original = model->Meshes[m];
+			for (int t = 0; t < tableParts.size(); t++) {
+				Mesh rebuilt = original;
+				rebuilt.MeshIndex = t == 0 ? m : model->Meshes.size();
+				rebuilt.Vertices.clear();
+				rebuilt.Indices.clear();
+				rebuilt.Submeshes.clear();
+				for (int i = 0; i < tableParts[t].size(); i++) {
+					ImportedPart& part = importedParts[tableParts[t][i]];
+					int submesh = std::find(parts.begin(), parts.end(), tableParts[t][i]) - parts.begin();
+					Submesh child = original.Submeshes[submesh];
+					child.IndexOffset = rebuilt.Indices.size();
+					int vertexOffset = rebuilt.Vertices.size();
+					// Indices move with the part's vertices to where they are in the new mesh
+					for (int j = part.IndexOffset; j < part.IndexOffset + part.IndexCount; j++) {
+						rebuilt.Indices.push_back(original.Indices[j] - part.VertexOffset + vertexOffset);
+					}
+					rebuilt.Vertices.insert(rebuilt.Vertices.end(), original.Vertices.begin() + part.VertexOffset, original.Vertices.begin() + part.VertexOffset + part.VertexCount);
+					rebuilt.Submeshes.push_back(child);
+					part.MeshIndex = rebuilt.MeshIndex;
+					part.IndexOffset = child.IndexOffset;
+					part.VertexOffset = vertexOffset;
+				}
+				if (t == 0) {
+					model->Meshes[m] = rebuilt;
+				}
+				else {
+					model->Meshes.push_back(rebuilt);
+					addedMeshes++;
+				}
+			}
+		}
+
+		for (int t = 0; t < tableParts.size(); t++) {
+			if (tableParts[t].size() == 0) {
+				continue;
+			}
+			Mesh& group = model->Meshes[importedParts[tableParts[t][0]].MeshIndex];
+			group.BoneTable.clear();
+			for (int word = 0; word < words; word++) {
+				for (uint64_t bits = tableUses[t][word]; bits != 0; bits &= bits - 1) {
+					int bone = word * 64 + (int)std::bitset<64>((bits & (~bits + 1)) - 1).count();
+					globalToTable[bone] = group.BoneTable.size();
+					group.BoneTable.push_back(bone);
+				}
+			}
+
+			for (int i = 0; i < tableParts[t].size(); i++) {
+				ImportedPart& part = importedParts[tableParts[t][i]];
+				for (int v = 0; v < part.VertexCount; v++) {
+					Vertex& vertex = group.Vertices[part.VertexOffset + v];
+					for (int w = 0; w < 4; w++) {
+						vertex.BlendIndices[w] = vertex.BlendWeights[w] > 0 ? globalToTable[part.Bones[vertex.BlendIndices[w]]] : 0;
+					}
+				}
+			}
+			Instrumentation::AddCount("bone_table_entries", group.BoneTable.size());
+		}
+	}
+
+	if (addedMeshes > 0) {
+		Instrumentation::AddCount("split_meshes", addedMeshes);
+		// Later passes expect the parts of each mesh together and in submesh order
+		std::stable_sort(importedParts.begin(), importedParts.end(), [](const ImportedPart& a, const ImportedPart& b) {
+			return a.MeshIndex != b.MeshIndex ? a.MeshIndex < b.MeshIndex : a.IndexOffset < b.IndexOffset;
+		});
+	}
+}
+
+// Every part and lod ratio is simplified on its own thread, then each lod is put together from its parts.
+// Lod parts only reference the vertices their triangles still use; shapes are not carried over.
+void FbxToMdlConverter::GenerateLods(Model* model) {
+	if (lodRatios.empty()) {
+		return;
+	}
+	ScopedTimer timer("GenerateLods");
+
+	int jobCount = importedParts.size() * lodRatios.size();
+	std::vector<std::vector<int>> simplified(jobCount);
+	std::atomic<int> nextJob(0);
+	auto work = [&]() {
+		int i;
+		std::vector<int> partIndices;
+		while ((i = nextJob++) < jobCount) {
+			ImportedPart& part = importedParts[i % importedParts.size()];
+			float ratio = lodRatios[i / importedParts.size()];
+			Mesh& group = model->Meshes[part.MeshIndex];
+			partIndices.resize(part.IndexCount);
+			for (int j = 0; j < part.IndexCount; j++) {
+				partIndices[j] = group.Indices[part.IndexOffset + j] - part.VertexOffset;
+			}
+			MeshSimplifier::Simplify(&group.Vertices[part.VertexOffset], part.VertexCount, partIndices.data(), partIndices.size(), ratio,
+				part.ShapeVertices, simplified[i]);
+		}
+	};
+
+	int workers = std::min(threadCount > 0 ? threadCount : std::max(1, (int)std::thread::hardware_concurrency()), jobCount);
+	std::vector<std::thread> threads;
+	for (int t = 1; t < workers; t++) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (int t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+
+	for (int l = 0; l < lodRatios.size(); l++) {
+		Model* lod = new Model();
+		for (int m = 0; m < model->Meshes.size(); m++) {
+			Mesh lodMesh = model->Meshes[m];
+			lodMesh.Vertices.clear();
+			lodMesh.Indices.clear();
+			lodMesh.Submeshes.clear();
+			lod->Meshes.push_back(lodMesh);
+		}
+
+		int triangles = 0;
+		std::vector<int> oldToNew;
+		for (int p = 0; p < importedParts.size(); p++) {
+			ImportedPart& part = importedParts[p];
+			Mesh& group = model->Meshes[part.MeshIndex];
+			Mesh& lodMesh = lod->Meshes[part.MeshIndex];
+			std::vector<int>& indices = simplified[l * importedParts.size() + p];
+
+			Submesh child = group.Submeshes[lodMesh.Submeshes.size()];
+			child.Shapes.clear();
+			child.IndexOffset = lodMesh.Indices.size();
+			child.IndexNum = indices.size();
+
+			// Keep the part's vertices in their original order, dropping the ones no triangle uses any more
+			oldToNew.assign(part.VertexCount, -1);
+			for (int i = 0; i < indices.size(); i++) {
+				oldToNew[indices[i]] = 0;
+			}
+			// Lod indices are relative to the lod mesh's vertex buffer like the model's
+			int used = lodMesh.Vertices.size();
+			for (int v = 0; v < part.VertexCount; v++) {
+				if (oldToNew[v] == -1) continue;
+				oldToNew[v] = used++;
+				lodMesh.Vertices.push_back(group.Vertices[part.VertexOffset + v]);
+			}
+			for (int i = 0; i < indices.size(); i++) {
+				lodMesh.Indices.push_back(oldToNew[indices[i]]);
+			}
+			lodMesh.Submeshes.push_back(child);
+			triangles += indices.size() / 3;
+		}
+
+		Instrumentation::Log(LogLevel::Info, "lod%d: %d triangles at ratio %.2f", l + 1, triangles, lodRatios[l]);
+		Instrumentation::AddCount(("lod" + std::to_string(l + 1) + "_triangles").c_str(), triangles);
+		generatedLods.push_back(lod);
+	}
+}
+
+void FbxToMdlConverter::DeleteImportedModels() {
+	delete importedModel;
+	importedModel = NULL;
+	for (int i = 0; i < generatedLods.size(); i++) {
+		delete generatedLods[i];
+	}
+	generatedLods.clear();
 }
 
 FbxSkin* FbxToMdlConverter::GetSkin(FbxMesh* mesh) {
@@ -486,7 +1216,7 @@ int FbxToMdlConverter::GetDirectIndex(FbxMesh* mesh, FbxLayerElementTemplate<Fbx
 	// Pick which index we're using.
 	int index = 0;
 	if (mapMode == FbxLayerElement::eByControlPoint) {
-		index = mesh->GetPolygonVertex(index_id / 3, index_id % 3);
+		index = mesh->GetPolygonVertices()[index_id];
 	}
 	else if (mapMode == FbxLayerElement::eByPolygonVertex) {
 		index = index_id;
@@ -521,7 +1251,7 @@ int FbxToMdlConverter::GetDirectIndex(FbxMesh* mesh, FbxLayerElementTemplate<Fbx
 	// Pick which index we're using.
 	int index = 0;
 	if (mapMode == FbxLayerElement::eByControlPoint) {
-		index = mesh->GetPolygonVertex(index_id / 3, index_id % 3);
+		index = mesh->GetPolygonVertices()[index_id];
 	}
 	else if (mapMode == FbxLayerElement::eByPolygonVertex) {
 		index = index_id;
@@ -556,7 +1286,7 @@ int FbxToMdlConverter::GetDirectIndex(FbxMesh* mesh, FbxLayerElementTemplate<Fbx
 	// Pick which index we're using.
 	int index = 0;
 	if (mapMode == FbxLayerElement::eByControlPoint) {
-		index = mesh->GetPolygonVertex(index_id / 3, index_id % 3);
+		index = mesh->GetPolygonVertices()[index_id];
 	}
 	else if (mapMode == FbxLayerElement::eByPolygonVertex) {
 		index = index_id;
@@ -580,19 +1310,19 @@ int FbxToMdlConverter::GetDirectIndex(FbxMesh* mesh, FbxLayerElementTemplate<Fbx
 	return index;
 }
 
-// Get the raw position value for a triangle index.
+// Get the raw position value for a polygon vertex index.
 FbxVector4 FbxToMdlConverter::GetPosition(FbxMesh* const mesh, int index_id) {
 	FbxVector4 def = FbxVector4(0, 0, 0, 0);
 	if (mesh->GetLayerCount() < 1) {
 		return def;
 	}
 	FbxLayer* layer = mesh->GetLayer(0);
-	int vertex_id = mesh->GetPolygonVertex(index_id / 3, index_id % 3);
+	int vertex_id = mesh->GetPolygonVertices()[index_id];
 	FbxVector4 position = mesh->GetControlPointAt(vertex_id);
 	return position;
 }
 
-// Get the raw normal value for a triangle index.
+// Get the raw normal value for a polygon vertex index.
 FbxVector4 FbxToMdlConverter::GetNormal(FbxMesh* const mesh, int index_id) {
 	FbxVector4 def = FbxVector4(0, 0, 0, 1.0);
 	if (mesh->GetLayerCount() < 1) {
@@ -604,7 +1334,7 @@ FbxVector4 FbxToMdlConverter::GetNormal(FbxMesh* const mesh, int index_id) {
 	return index == -1 ? def : layerElement->GetDirectArray().GetAt(index);
 }
 
-// Get the raw uv1 value for a triangle index.
+// Get the raw uv1 value for a polygon vertex index.
 FbxVector2 FbxToMdlConverter::GetUV1(FbxMesh* const mesh, int index_id) {
 	FbxVector2 def = FbxVector2(0, 0);
 	if (mesh->GetLayerCount() < 1) {
@@ -616,7 +1346,7 @@ FbxVector2 FbxToMdlConverter::GetUV1(FbxMesh* const mesh, int index_id) {
 	return index == -1 ? def : uvs->GetDirectArray().GetAt(index);
 }
 
-// Get the raw uv2 value for a triangle index.
+// Get the raw uv2 value for a polygon vertex index.
 FbxVector2 FbxToMdlConverter::GetUV2(FbxMesh* const mesh, int index_id) {
 	FbxVector2 def = FbxVector2(0, 0);
 	if (mesh->GetLayerCount() < 2) {
@@ -628,7 +1358,7 @@ FbxVector2 FbxToMdlConverter::GetUV2(FbxMesh* const mesh, int index_id) {
 	return index == -1 ? def : uvs->GetDirectArray().GetAt(index);
 }
 
-// Gets the raw vertex color value for a triangle index.
+// Gets the raw vertex color value for a polygon vertex index.
 FbxColor FbxToMdlConverter::GetVertexColor(FbxMesh* const mesh, int index_id) {
 	FbxColor def = FbxColor(1, 1, 1, 1);
 	if (mesh->GetLayerCount() < 1) {
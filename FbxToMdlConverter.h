@@ -4,20 +4,105 @@
 #include <map>
 #include <fbxsdk.h>
 #include "LuminaPlusPlus/Models/Models/Mesh.h"
+#include "LuminaPlusPlus/Models/Models/Model.h"
+#include "ScratchArena.h"
+#include "Instrumentation.h"
+#include "VertexTransform.h"
 //#include <LuminaPlusPlus/Data/Files/MdlFile.h>
+// Keeps one FbxManager for its whole life, so importing many files only pays for the SDK setup once.
+// A converter is not thread safe; parallel imports each use their own.
 class FbxToMdlConverter
 {
 public:
+	__declspec(dllexport) FbxToMdlConverter();
+	__declspec(dllexport) ~FbxToMdlConverter();
+	// Owns its FbxManager and the models it built, so it can't be copied
+	FbxToMdlConverter(const FbxToMdlConverter&) = delete;
+	FbxToMdlConverter& operator=(const FbxToMdlConverter&) = delete;
+
 	__declspec(dllexport) int ImportFbx(std::string fbxFilePath);
+	// Timings and counters of the last ImportFbx
+	ConversionReport GetLastReport();
+	// The model the last ImportFbx built, or NULL if it failed. The converter owns it and deletes it at the next import.
+	Model* GetImportedModel();
+	// Bounds of what the last ImportFbx saved, for the mdl's bounding boxes. Valid until the next import.
+	Bounds GetModelBounds();
+	Bounds GetMeshBounds(int meshIndex);
+	// Reorders each part's triangles and vertices for the GPU's vertex cache. Off by default.
+	void SetOptimizeVertexCache(bool optimize);
+	// Builds a lower detail copy of the model for each ratio of triangles to keep, e.g. { 0.5f, 0.25f } for lod1 and lod2.
+	// None by default.
+	void SetLodRatios(std::vector<float> ratios);
+	// The lods SetLodRatios asked for, lod1 first, as built by the last ImportFbx. The converter owns them and
+	// deletes them at the next import. NULL for a lod that wasn't generated.
+	Model* GetGeneratedLod(int lod);
+	int GetGeneratedLodCount();
+	// Threads the lod generation may use, including the calling one. 0, the default, is one per core; a caller that
+	// already runs converters in parallel should pass 1.
+	void SetThreadCount(int count);
+
+	// Scratch memory is released after every import; a shared arena lets a batch reuse it between files
+	void SetArena(ScratchArena* externalArena);
 
 private:
 	FbxManager* manager;
-	FbxScene* scene;
+	FbxScene* scene = NULL;
 	std::vector<std::string> BoneNames;
+	std::map<int, std::map<int, FbxNode*>> groupPartToNode;
+	// Where each saved part's vertices and indices ended up, for the passes that run once the whole model is built
+	struct ImportedPart {
+		int MeshIndex;
+		int IndexOffset;
+		int IndexCount;
+		int VertexOffset;
+		int VertexCount;
+		// Part vertices that any shape moves
+		std::vector<int> ShapeVertices;
+		// BoneNames index of each bone the part's BlendIndices refer to, until BuildBoneTables remaps them to the mesh's table
+		std::vector<int> Bones;
+		Bounds PartBounds;
+	};
+	std::vector<ImportedPart> importedParts;
+	// A saved part's vertices, indices and shapes. Oversized parts are saved as several of these, each in its own mesh.
+	struct PartChunk {
+		std::pmr::vector<Vertex> Vertices;
+		std::pmr::vector<int> Indices;
+		std::pmr::map<std::pmr::string, std::pmr::map<int, Vertex>> ShapeVertices;
+
+		PartChunk(std::pmr::memory_resource* resource) : Vertices(resource), Indices(resource), ShapeVertices(resource) {}
+	};
+	// Meshes made for the chunks of split parts, added to the model after the fbx's own meshes
+	std::vector<Mesh> splitMeshes;
+	int nextMeshIndex = 0;
+	// Vertices a mesh's 16 bit indices can reference
+	static const int MaxPartVertices = 0xFFFF;
+	// Bones a mesh's bone table can hold
+	static const int MaxBoneTableSize = 64;
+	ConversionReport lastReport;
+	Bounds modelBounds;
+	std::vector<Bounds> meshBounds;
+	bool optimizeVertexCache = false;
+	std::vector<float> lodRatios;
+	int threadCount = 0;
+	// Kept until the next import
+	Model* importedModel = NULL;
+	// One per lod ratio, kept until the next import
+	std::vector<Model*> generatedLods;
+	ScratchArena ownedArena;
+	ScratchArena* arena = &ownedArena;
 	//MdlFile* mdlFile;
 
+	int Import(std::string fbxFilePath);
 	void TestNode(FbxNode* pNode);
 	void SaveNode(Mesh* parent, FbxNode* pNode, int subMeshIndex);
+	bool ValidateMesh(FbxNode* node, int& triangleCorners);
+	void TriangulateMesh(FbxMesh* mesh, std::pmr::vector<int>& corners);
+	void SplitPart(std::pmr::vector<Vertex>& vertices, std::pmr::vector<int>& triIndices,
+		std::pmr::map<std::pmr::string, std::pmr::map<int, Vertex>>& shapeVertices, const std::pmr::vector<int>& partBones,
+		std::pmr::vector<PartChunk>& chunks);
+	void BuildBoneTables(Model* model);
+	void GenerateLods(Model* model);
+	void DeleteImportedModels();
 
 	FbxSkin* GetSkin(FbxMesh* mesh);
 	FbxBlendShape* GetMorpher(FbxMesh* mesh);
@@ -0,0 +1,401 @@
+#include "GlbWriter.h"
+#include "Instrumentation.h"
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+using json = nlohmann::json;
+
+// https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html
+static const int ComponentUnsignedByte = 5121;
+static const int ComponentUnsignedShort = 5123;
+static const int ComponentFloat = 5126;
+static const int TargetArrayBuffer = 34962;
+static const int TargetElementArrayBuffer = 34963;
+
+static unsigned char ToUnorm8(float value) {
+	if (value <= 0.0f) return 0;
+	if (value >= 1.0f) return 255;
+	return (unsigned char)std::lround(value * 255.0f);
+}
+
+GlbWriter::GlbWriter() {
+	json root;
+	root["name"] = "root name";
+	root["children"] = json::array();
+	nodes.push_back(root);
+	rootNode = 0;
+}
+
+void GlbWriter::AddSkeleton(Bone* root, const std::vector<Bone*>& skinBones) {
+	if (root == NULL) return;
+
+	int skeletonNode = AddBone(root);
+	nodes[rootNode]["children"].push_back(skeletonNode);
+
+	if (skinBones.size() == 0) {
+		return;
+	}
+
+	// Inverse bind matrices are the inverse of each joint's world matrix, column major like Eigen stores them
+	std::vector<float> inverseBinds;
+	json joints = json::array();
+	for (int i = 0; i < skinBones.size(); i++) {
+		joints.push_back(BoneToNode[skinBones[i]]);
+		Eigen::Matrix4d inverse = skinBones[i]->WorldMatrix.inverse();
+		for (int j = 0; j < 16; j++) {
+			inverseBinds.push_back((float)inverse.data()[j]);
+		}
+	}
+
+	int view = AddBufferView(inverseBinds.data(), inverseBinds.size() * sizeof(float), -1);
+	json skin;
+	skin["inverseBindMatrices"] = AddAccessor(view, ComponentFloat, skinBones.size(), "MAT4");
+	skin["joints"] = joints;
+	skin["skeleton"] = skeletonNode;
+	skins.push_back(skin);
+	skinJointCount = skinBones.size();
+}
+
+int GlbWriter::AddBone(Bone* bone) {
+	Eigen::Matrix4d local = bone->PoseMatrix.matrix();
+
+	json node;
+	node["name"] = bone->Name;
+	std::vector<double> matrix(local.data(), local.data() + 16);
+	node["matrix"] = matrix;
+
+	int index = nodes.size();
+	nodes.push_back(node);
+	BoneToNode.emplace(bone, index);
+
+	for (int i = 0; i < bone->Children.size(); i++) {
+		int child = AddBone(bone->Children[i]);
+		nodes[index]["children"].push_back(child);
+	}
+	return index;
+}
+
+void GlbWriter::AddGroup(std::string name) {
+	json node;
+	node["name"] = name;
+	currentGroupNode = nodes.size();
+	nodes.push_back(node);
+	nodes[rootNode]["children"].push_back(currentGroupNode);
+}
+
+int GlbWriter::GetMaterial(std::string materialPath) {
+	auto it = MaterialPathToIndex.find(materialPath);
+	if (it != MaterialPathToIndex.end()) {
+		return it->second;
+	}
+
+	// Textures are game paths that a viewer can't resolve, so only the name carries over
+	json material;
+	material["name"] = materialPath;
+	material["pbrMetallicRoughness"] = { { "baseColorFactor", { 1.0, 1.0, 1.0, 1.0 } }, { "metallicFactor", 0.0 }, { "roughnessFactor", 0.5 } };
+	int index = materials.size();
+	materials.push_back(material);
+	MaterialPathToIndex.emplace(materialPath, index);
+	return index;
+}
+
+void GlbWriter::AddPart(std::string name, Mesh* group, PartVertices& partVertices) {
+	VertexStreams& vertices = partVertices.Vertices;
+	if (vertices.size() == 0 || partVertices.Indices.size() == 0) {
+		return;
+	}
+	if (currentGroupNode == -1) {
+		AddGroup("Group");
+	}
+	size_t count = vertices.size();
+
+	// Positions go in as they are; normals need to be unit length for glTF
+	std::vector<float> normals;
+	std::vector<float> uv1;
+	std::vector<float> uv2;
+	std::vector<unsigned char> colors;
+	normals.reserve(count * 3);
+	uv1.reserve(count * 2);
+	uv2.reserve(count * 2);
+	colors.reserve(count * 4);
+
+	for (size_t i = 0; i < count; i++) {
+		const float* n = vertices.Normal(i);
+		float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0) length = 1;
+
+		for (int c = 0; c < 3; c++) {
+			normals.push_back(n[c] / length);
+		}
+		// FBX flips v for its bottom-left origin; glTF is top-left like the game, so the uvs go in as they are
+		uv1.push_back(vertices.UV(i, 0));
+		uv1.push_back(vertices.UV(i, 1));
+		uv2.push_back(vertices.UV(i, 2));
+		uv2.push_back(vertices.UV(i, 3));
+		if (vertices.IsPacked()) {
+			const unsigned char* color = vertices.PackedColor(i);
+			colors.insert(colors.end(), color, color + 4);
+		}
+		else {
+			for (int c = 0; c < 4; c++) {
+				colors.push_back(ToUnorm8(vertices.Color(i, c)));
+			}
+		}
+	}
+
+	json attributes;
+	attributes["POSITION"] = AddVec3Accessor(vertices.Positions.data(), vertices.Positions.size() / 3, TargetArrayBuffer, true);
+	attributes["NORMAL"] = AddVec3Accessor(normals.data(), normals.size() / 3, TargetArrayBuffer, false);
+	attributes["TEXCOORD_0"] = AddAccessor(AddBufferView(uv1.data(), uv1.size() * sizeof(float), TargetArrayBuffer), ComponentFloat, count, "VEC2");
+	attributes["TEXCOORD_1"] = AddAccessor(AddBufferView(uv2.data(), uv2.size() * sizeof(float), TargetArrayBuffer), ComponentFloat, count, "VEC2");
+	attributes["COLOR_0"] = AddAccessor(AddBufferView(colors.data(), colors.size(), TargetArrayBuffer), ComponentUnsignedByte, count, "VEC4", true);
+
+	bool skinned = skins.size() > 0;
+	if (skinned) {
+		// Joints are indices into ModelBones, which is also the order of the skin's joints
+		bool wideJoints = skinJointCount > 255;
+		std::vector<unsigned char> joints8;
+		std::vector<uint16_t> joints16;
+		std::vector<unsigned char> weights;
+
+		for (size_t i = 0; i < count; i++) {
+			const unsigned char* packedWeights = vertices.IsPacked() ? vertices.PackedBlendWeights(i) : NULL;
+			int quantized[4];
+			int total = 0;
+			int largest = 0;
+
+			for (int wi = 0; wi < 4; wi++) {
+				int joint = group->BoneTable[vertices.BlendIndex(i, wi)];
+				// Packed weights are already unorm8
+				quantized[wi] = packedWeights != NULL ? packedWeights[wi] : ToUnorm8(vertices.BlendWeight(i, wi));
+				if (joint >= skinJointCount || quantized[wi] == 0) {
+					joint = 0;
+					quantized[wi] = 0;
+				}
+				if (wideJoints) joints16.push_back(joint);
+				else joints8.push_back(joint);
+
+				total += quantized[wi];
+				if (quantized[wi] > quantized[largest]) largest = wi;
+			}
+			// Quantised weights have to sum to exactly 255; the rounding error goes on the largest one
+			if (total > 0) {
+				quantized[largest] += 255 - total;
+			}
+			for (int wi = 0; wi < 4; wi++) {
+				weights.push_back((unsigned char)quantized[wi]);
+			}
+		}
+
+		if (wideJoints) {
+			attributes["JOINTS_0"] = AddAccessor(AddBufferView(joints16.data(), joints16.size() * sizeof(uint16_t), TargetArrayBuffer), ComponentUnsignedShort, count, "VEC4");
+		}
+		else {
+			attributes["JOINTS_0"] = AddAccessor(AddBufferView(joints8.data(), joints8.size(), TargetArrayBuffer), ComponentUnsignedByte, count, "VEC4");
+		}
+		attributes["WEIGHTS_0"] = AddAccessor(AddBufferView(weights.data(), weights.size(), TargetArrayBuffer), ComponentUnsignedByte, count, "VEC4", true);
+	}
+
+	json primitive;
+	primitive["attributes"] = attributes;
+	primitive["indices"] = AddAccessor(AddBufferView(partVertices.Indices.data(), partVertices.Indices.size() * sizeof(uint16_t), TargetElementArrayBuffer), ComponentUnsignedShort, partVertices.Indices.size(), "SCALAR");
+	primitive["mode"] = 4;
+	if (group->Material != NULL) {
+		primitive["material"] = GetMaterial(group->Material->MaterialPath);
+	}
+
+	json mesh;
+	mesh["name"] = name + " Mesh Attribute";
+
+	if (partVertices.Shapes.size() > 0) {
+		json targets = json::array();
+		json targetNames = json::array();
+		json weights = json::array();
+
+		for (int s = 0; s < partVertices.Shapes.size(); s++) {
+			PartShape& shape = partVertices.Shapes[s];
+
+			// Morph targets are already deltas, so they can be written as sparse accessors as they are
+			json target;
+			target["POSITION"] = AddSparseVec3Accessor(count, shape.Indices.data(), shape.PositionDeltas.data(), shape.Indices.size(), true);
+			target["NORMAL"] = AddSparseVec3Accessor(count, shape.Indices.data(), shape.NormalDeltas.data(), shape.Indices.size(), false);
+			targets.push_back(target);
+			targetNames.push_back(shape.Source->ShapeName);
+			weights.push_back(0.0);
+			Instrumentation::AddCount("shapes", 1);
+		}
+		primitive["targets"] = targets;
+		mesh["weights"] = weights;
+		mesh["extras"] = { { "targetNames", targetNames } };
+	}
+	mesh["primitives"] = json::array();
+	mesh["primitives"].push_back(primitive);
+
+	int meshIndex = meshes.size();
+	meshes.push_back(mesh);
+
+	json node;
+	node["name"] = name;
+	node["mesh"] = meshIndex;
+	if (skinned) {
+		node["skin"] = 0;
+	}
+	int nodeIndex = nodes.size();
+	nodes.push_back(node);
+	nodes[currentGroupNode]["children"].push_back(nodeIndex);
+
+	Instrumentation::AddCount("vertices", count);
+	Instrumentation::AddCount("indices", partVertices.Indices.size());
+}
+
+// Every view starts on a 4 byte boundary so float data stays aligned
+int GlbWriter::AddBufferView(const void* data, size_t length, int target) {
+	size_t offset = bin.size();
+	bin.insert(bin.end(), (const char*)data, (const char*)data + length);
+	while (bin.size() % 4 != 0) {
+		bin.push_back(0);
+	}
+
+	json view;
+	view["buffer"] = 0;
+	view["byteOffset"] = offset;
+	view["byteLength"] = length;
+	if (target != -1) {
+		view["target"] = target;
+	}
+	bufferViews.push_back(view);
+	return bufferViews.size() - 1;
+}
+
+int GlbWriter::AddAccessor(int bufferView, int componentType, size_t count, const char* type, bool normalized) {
+	json accessor;
+	accessor["bufferView"] = bufferView;
+	accessor["componentType"] = componentType;
+	accessor["count"] = count;
+	accessor["type"] = type;
+	if (normalized) {
+		accessor["normalized"] = true;
+	}
+	accessors.push_back(accessor);
+	return accessors.size() - 1;
+}
+
+int GlbWriter::AddVec3Accessor(const float* values, size_t count, int target, bool withBounds) {
+	int index = AddAccessor(AddBufferView(values, count * 3 * sizeof(float), target), ComponentFloat, count, "VEC3");
+
+	// Required for POSITION, including morph target positions
+	if (withBounds && count > 0) {
+		float min[3] = { values[0], values[1], values[2] };
+		float max[3] = { values[0], values[1], values[2] };
+		for (size_t i = 1; i < count; i++) {
+			for (int c = 0; c < 3; c++) {
+				min[c] = std::min(min[c], values[i * 3 + c]);
+				max[c] = std::max(max[c], values[i * 3 + c]);
+			}
+		}
+		accessors[index]["min"] = { min[0], min[1], min[2] };
+		accessors[index]["max"] = { max[0], max[1], max[2] };
+	}
+	return index;
+}
+
+// A zero-initialised accessor with only the given elements set. Indices have to be ascending.
+int GlbWriter::AddSparseVec3Accessor(size_t count, const uint16_t* indices, const float* values, size_t sparseCount, bool withBounds) {
+	json accessor;
+	accessor["componentType"] = ComponentFloat;
+	accessor["count"] = count;
+	accessor["type"] = "VEC3";
+
+	if (sparseCount > 0) {
+		json sparse;
+		sparse["count"] = sparseCount;
+		sparse["indices"] = { { "bufferView", AddBufferView(indices, sparseCount * sizeof(uint16_t), -1) }, { "componentType", ComponentUnsignedShort } };
+		sparse["values"] = { { "bufferView", AddBufferView(values, sparseCount * 3 * sizeof(float), -1) } };
+		accessor["sparse"] = sparse;
+	}
+
+	if (withBounds) {
+		float min[3] = { 0, 0, 0 };
+		float max[3] = { 0, 0, 0 };
+		bool untouchedVertices = sparseCount < count;
+		for (size_t i = 0; i < sparseCount; i++) {
+			for (int c = 0; c < 3; c++) {
+				if (i == 0 && !untouchedVertices) {
+					min[c] = max[c] = values[c];
+				}
+				min[c] = std::min(min[c], values[i * 3 + c]);
+				max[c] = std::max(max[c], values[i * 3 + c]);
+			}
+		}
+		accessor["min"] = { min[0], min[1], min[2] };
+		accessor["max"] = { max[0], max[1], max[2] };
+	}
+
+	accessors.push_back(accessor);
+	return accessors.size() - 1;
+}
+
+void GlbWriter::Serialize(std::vector<char>& out) {
+	ScopedTimer timer("ExportScene");
+
+	json gltf;
+	gltf["asset"] = { { "version", "2.0" }, { "generator", "MdlFbxConverter" } };
+	gltf["scene"] = 0;
+	json scene;
+	scene["nodes"] = json::array({ rootNode });
+	gltf["scenes"] = json::array();
+	gltf["scenes"].push_back(scene);
+	gltf["nodes"] = nodes;
+	if (meshes.size() > 0) gltf["meshes"] = meshes;
+	if (materials.size() > 0) gltf["materials"] = materials;
+	if (skins.size() > 0) gltf["skins"] = skins;
+	if (bin.size() > 0) {
+		gltf["accessors"] = accessors;
+		gltf["bufferViews"] = bufferViews;
+		json buffer;
+		buffer["byteLength"] = bin.size();
+		gltf["buffers"] = json::array();
+		gltf["buffers"].push_back(buffer);
+	}
+
+	std::string jsonChunk = gltf.dump();
+	while (jsonChunk.size() % 4 != 0) {
+		jsonChunk.push_back(' ');
+	}
+
+	uint32_t jsonLength = jsonChunk.size();
+	uint32_t binLength = bin.size();
+	uint32_t totalLength = 12 + 8 + jsonLength + (binLength > 0 ? 8 + binLength : 0);
+
+	out.clear();
+	out.reserve(totalLength);
+
+	uint32_t header[3] = { 0x46546C67, 2, totalLength };	// "glTF", version 2
+	out.insert(out.end(), (const char*)header, (const char*)header + sizeof(header));
+
+	uint32_t jsonHeader[2] = { jsonLength, 0x4E4F534A };	// "JSON"
+	out.insert(out.end(), (const char*)jsonHeader, (const char*)jsonHeader + sizeof(jsonHeader));
+	out.insert(out.end(), jsonChunk.data(), jsonChunk.data() + jsonLength);
+
+	if (binLength > 0) {
+		uint32_t binHeader[2] = { binLength, 0x004E4942 };	// "BIN\0"
+		out.insert(out.end(), (const char*)binHeader, (const char*)binHeader + sizeof(binHeader));
+		out.insert(out.end(), bin.data(), bin.data() + binLength);
+	}
+
+	Instrumentation::AddCount("bytes_written", totalLength);
+}
+
+int GlbWriter::Write(std::string path) {
+	std::vector<char> data;
+	Serialize(data);
+
+	std::ofstream ofs(path, std::ios::binary);
+	if (!ofs.is_open()) {
+		Instrumentation::Log(LogLevel::Error, "Could not open %s for writing", path.c_str());
+		return -1;
+	}
+	ofs.write(data.data(), data.size());
+	ofs.close();
+	return 0;
+}
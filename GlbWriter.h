@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "include/json.hpp"
+#include "MdlToFbxConverter.h"
+
+// Writes binary glTF straight from the prepared part buffers, without going through the FBX SDK.
+// Every accessor is packed into one contiguous BIN chunk: float3 positions/normals, float2 uvs,
+// unorm8 colours and weights, and uint8/uint16 joints and indices. Morph targets are sparse accessors.
+class GlbWriter
+{
+public:
+	GlbWriter();
+
+	// skinBones are in the order BoneTable refers to them, which is also the order of the skin's joints
+	void AddSkeleton(Bone* root, const std::vector<Bone*>& skinBones);
+	void AddGroup(std::string name);
+	// Added to the most recent group
+	void AddPart(std::string name, Mesh* group, PartVertices& partVertices);
+	int Write(std::string path);
+	// The whole .glb file, for callers that write it themselves
+	void Serialize(std::vector<char>& out);
+
+private:
+	nlohmann::json nodes = nlohmann::json::array();
+	nlohmann::json meshes = nlohmann::json::array();
+	nlohmann::json materials = nlohmann::json::array();
+	nlohmann::json accessors = nlohmann::json::array();
+	nlohmann::json bufferViews = nlohmann::json::array();
+	nlohmann::json skins = nlohmann::json::array();
+	std::vector<char> bin;
+
+	int rootNode;
+	int currentGroupNode = -1;
+	int skinJointCount = 0;
+	std::map<Bone*, int> BoneToNode;
+	std::map<std::string, int> MaterialPathToIndex;
+
+	int AddBone(Bone* bone);
+	int GetMaterial(std::string materialPath);
+	int AddBufferView(const void* data, size_t length, int target);
+	int AddAccessor(int bufferView, int componentType, size_t count, const char* type, bool normalized = false);
+	int AddVec3Accessor(const float* values, size_t count, int target, bool withBounds);
+	int AddSparseVec3Accessor(size_t count, const uint16_t* indices, const float* values, size_t sparseCount, bool withBounds);
+};
\ No newline at end of file
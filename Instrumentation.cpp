@@ -0,0 +1,156 @@
+#include "Instrumentation.h"
+#include "include/json.hpp"
+#include <cstdarg>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+using json = nlohmann::json;
+
+// Read by every thread that logs, so it can be changed while conversions run
+static std::atomic<LogLevel> currentLogLevel(LogLevel::Info);
+static Instrumentation::LogCallback logCallback;
+static Instrumentation::ReportCallback reportCallback;
+static std::string reportFilePath;
+static std::mutex sinkMutex;
+
+static thread_local ConversionReport currentReport;
+static thread_local int reportDepth = 0;
+static thread_local std::chrono::steady_clock::time_point reportStart;
+
+std::string ConversionReport::ToJson() const {
+	json j;
+	j["name"] = Name;
+	j["total_ms"] = TotalMilliseconds;
+
+	json stages = json::object();
+	for (int i = 0; i < Stages.size(); i++) {
+		stages[Stages[i].Stage] = { { "ms", Stages[i].Milliseconds }, { "calls", Stages[i].Calls } };
+	}
+	j["stages"] = stages;
+
+	json counters = json::object();
+	for (int i = 0; i < Counters.size(); i++) {
+		counters[Counters[i].Name] = Counters[i].Value;
+	}
+	j["counters"] = counters;
+
+	return j.dump();
+}
+
+void Instrumentation::SetLogLevel(LogLevel level) {
+	currentLogLevel = level;
+}
+
+LogLevel Instrumentation::GetLogLevel() {
+	return currentLogLevel;
+}
+
+void Instrumentation::SetLogCallback(LogCallback callback) {
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	logCallback = callback;
+}
+
+void Instrumentation::Log(LogLevel level, const char* format, ...) {
+	// Checked before formatting so messages below the level cost nothing in hot loops
+	if (level < currentLogLevel.load(std::memory_order_relaxed) || level == LogLevel::None) {
+		return;
+	}
+
+	char buffer[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	if (logCallback) {
+		logCallback(level, std::string(buffer));
+	}
+	else if (level >= LogLevel::Warning) {
+		fprintf(stderr, "%s\n", buffer);
+	}
+	else {
+		fprintf(stdout, "%s\n", buffer);
+	}
+}
+
+void Instrumentation::SetReportCallback(ReportCallback callback) {
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	reportCallback = callback;
+}
+
+void Instrumentation::SetReportFile(std::string filePath) {
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	reportFilePath = filePath;
+}
+
+void Instrumentation::BeginReport(std::string name) {
+	if (reportDepth++ > 0) {
+		return;
+	}
+	currentReport = ConversionReport();
+	currentReport.Name = name;
+	reportStart = std::chrono::steady_clock::now();
+}
+
+ConversionReport Instrumentation::EndReport() {
+	if (reportDepth == 0 || --reportDepth > 0) {
+		return ConversionReport();
+	}
+	currentReport.TotalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reportStart).count();
+
+	std::lock_guard<std::mutex> lock(sinkMutex);
+	if (reportCallback) {
+		reportCallback(currentReport);
+	}
+	if (reportFilePath != "") {
+		std::ofstream ofs(reportFilePath, std::ios::app);
+		if (ofs.is_open()) {
+			ofs << currentReport.ToJson() << "\n";
+		}
+	}
+	return currentReport;
+}
+
+void Instrumentation::AddTime(const char* stage, double milliseconds) {
+	if (reportDepth == 0) {
+		return;
+	}
+	for (int i = 0; i < currentReport.Stages.size(); i++) {
+		if (currentReport.Stages[i].Stage == stage) {
+			currentReport.Stages[i].Milliseconds += milliseconds;
+			currentReport.Stages[i].Calls++;
+			return;
+		}
+	}
+	StageTiming timing;
+	timing.Stage = stage;
+	timing.Milliseconds = milliseconds;
+	timing.Calls = 1;
+	currentReport.Stages.push_back(timing);
+}
+
+void Instrumentation::AddCount(const char* counter, long long value) {
+	if (reportDepth == 0) {
+		return;
+	}
+	for (int i = 0; i < currentReport.Counters.size(); i++) {
+		if (currentReport.Counters[i].Name == counter) {
+			currentReport.Counters[i].Value += value;
+			return;
+		}
+	}
+	Counter c;
+	c.Name = counter;
+	c.Value = value;
+	currentReport.Counters.push_back(c);
+}
+
+ScopedTimer::ScopedTimer(const char* stage) {
+	this->stage = stage;
+	start = std::chrono::steady_clock::now();
+}
+
+ScopedTimer::~ScopedTimer() {
+	Instrumentation::AddTime(stage, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+
+enum class LogLevel {
+	Debug,
+	Info,
+	Warning,
+	Error,
+	None
+};
+
+struct StageTiming {
+	std::string Stage;
+	double Milliseconds = 0;
+	int Calls = 0;
+};
+
+struct Counter {
+	std::string Name;
+	long long Value = 0;
+};
+
+// Everything recorded between BeginReport and EndReport for one conversion
+struct ConversionReport {
+	std::string Name;
+	double TotalMilliseconds = 0;
+	std::vector<StageTiming> Stages;
+	std::vector<Counter> Counters;
+
+	std::string ToJson() const;
+};
+
+// Process wide logging, timers and counters.
+// Reports are kept per thread, so conversions running in parallel don't mix their numbers.
+static class Instrumentation
+{
+public:
+	typedef std::function<void(LogLevel, const std::string&)> LogCallback;
+	typedef std::function<void(const ConversionReport&)> ReportCallback;
+
+	static void SetLogLevel(LogLevel level);
+	static LogLevel GetLogLevel();
+	// Replaces the default of writing warnings and errors to stderr and everything else to stdout
+	static void SetLogCallback(LogCallback callback);
+	static void Log(LogLevel level, const char* format, ...);
+
+	static void SetReportCallback(ReportCallback callback);
+	// Appends every finished report to the file as a single line of json
+	static void SetReportFile(std::string filePath);
+
+	// Nested calls are folded into the outermost report
+	static void BeginReport(std::string name);
+	static ConversionReport EndReport();
+
+	static void AddTime(const char* stage, double milliseconds);
+	static void AddCount(const char* counter, long long value);
+};
+
+// Adds the time between construction and destruction to a stage of the current report
+class ScopedTimer
+{
+public:
+	ScopedTimer(const char* stage);
+	~ScopedTimer();
+
+private:
+	const char* stage;
+	std::chrono::steady_clock::time_point start;
+};
\ No newline at end of file
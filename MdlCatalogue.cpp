@@ -0,0 +1,356 @@
+#include "MdlCatalogue.h"
+#include "Instrumentation.h"
+#include "include/json.hpp"
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+static const uint32_t MdlVersion5 = 0x01000005;
+static const uint32_t MdlVersion6 = 0x01000006;
+// 17 elements of 8 bytes, whether or not they are all used
+static const size_t VertexDeclarationSize = 17 * 8;
+static const uint8_t ExtraLodEnabled = 0x10;
+
+#pragma pack(push, 1)
+struct MdlModelHeader {
+	float Radius;
+	uint16_t MeshCount;
+	uint16_t AttributeCount;
+	uint16_t SubmeshCount;
+	uint16_t MaterialCount;
+	uint16_t BoneCount;
+	uint16_t BoneTableCount;
+	uint16_t ShapeCount;
+	uint16_t ShapeMeshCount;
+	uint16_t ShapeValueCount;
+	uint8_t LodCount;
+	uint8_t Flags1;
+	uint16_t ElementIdCount;
+	uint8_t TerrainShadowMeshCount;
+	uint8_t Flags2;
+	float ModelClipOutDistance;
+	float ShadowClipOutDistance;
+	uint16_t CullingGridCount;
+	uint16_t TerrainShadowSubmeshCount;
+	uint8_t Flags3;
+	uint8_t BGChangeMaterialIndex;
+	uint8_t BGCrestChangeMaterialIndex;
+	uint8_t Unknown6;
+	uint16_t BoneTableArrayCountTotal;
+	uint16_t Unknown8;
+	uint16_t Unknown9;
+	uint8_t Padding[6];
+};
+
+struct MdlMeshLod {
+	uint16_t MeshIndex;
+	uint16_t MeshCount;
+	float ModelLodRange;
+	float TextureLodRange;
+	uint16_t WaterMeshIndex;
+	uint16_t WaterMeshCount;
+	uint16_t ShadowMeshIndex;
+	uint16_t ShadowMeshCount;
+	uint16_t TerrainShadowMeshIndex;
+	uint16_t TerrainShadowMeshCount;
+	uint16_t VerticalFogMeshIndex;
+	uint16_t VerticalFogMeshCount;
+	uint32_t EdgeGeometrySize;
+	uint32_t EdgeGeometryDataOffset;
+	uint32_t PolygonCount;
+	uint32_t Unknown1;
+	uint32_t VertexBufferSize;
+	uint32_t IndexBufferSize;
+	uint32_t VertexDataOffset;
+	uint32_t IndexDataOffset;
+};
+
+struct MdlShape {
+	uint32_t StringOffset;
+	uint16_t ShapeMeshStartIndex[3];
+	uint16_t ShapeMeshCount[3];
+};
+#pragma pack(pop)
+
+// Sizes of the structs that are skipped over
+static const size_t ElementIdSize = 32;
+static const size_t ExtraLodSize = 40;
+static const size_t MeshSize = 36;
+static const size_t TerrainShadowMeshSize = 20;
+static const size_t SubmeshSize = 16;
+static const size_t TerrainShadowSubmeshSize = 12;
+static const size_t BoneTableSize = 132;
+static const size_t BoneTableHeaderSize = 4;
+
+// Bounds checked reads over the header part of an mdl
+class HeaderReader
+{
+public:
+	HeaderReader(const char* data, size_t size) : pos(data), end(data + size) {}
+
+	template<typename T>
+	bool Read(T& value) {
+		if ((size_t)(end - pos) < sizeof(T)) return false;
+		memcpy(&value, pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	bool Skip(size_t bytes) {
+		if ((size_t)(end - pos) < bytes) return false;
+		pos += bytes;
+		return true;
+	}
+
+	const char* Current() { return pos; }
+
+private:
+	const char* pos;
+	const char* end;
+};
+
+MdlCatalogue::MdlCatalogue(int threadCount) {
+	if (threadCount <= 0) {
+		threadCount = std::thread::hardware_concurrency();
+	}
+	this->threadCount = threadCount > 0 ? threadCount : 1;
+}
+
+static bool ReadNames(HeaderReader& reader, int count, const MdlInfo& info, std::vector<std::string>& names) {
+	names.reserve(count);
+	for (int i = 0; i < count; i++) {
+		uint32_t offset;
+		if (!reader.Read(offset)) return false;
+		auto it = info.StringOffsetToStringMap.find(offset);
+		names.push_back(it != info.StringOffsetToStringMap.end() ? it->second : std::string());
+	}
+	return true;
+}
+
+bool MdlCatalogue::ReadInfo(const char* data, size_t size, MdlInfo& info, std::string& error) {
+	HeaderReader reader(data, size);
+	MdlFileHeader fileHeader;
+	if (!reader.Read(fileHeader)) {
+		error = "too small for an mdl header";
+		return false;
+	}
+	if (fileHeader.Version != MdlVersion5 && fileHeader.Version != MdlVersion6) {
+		error = "unknown mdl version";
+		return false;
+	}
+	info.Version = fileHeader.Version;
+
+	if (!reader.Skip(fileHeader.VertexDeclarationCount * VertexDeclarationSize)) {
+		error = "truncated vertex declarations";
+		return false;
+	}
+
+	// The string table: every name in the model, null terminated, looked up by its offset into the table
+	uint32_t stringCount;
+	uint32_t stringSize;
+	if (!reader.Read(stringCount) || !reader.Read(stringSize)) {
+		error = "truncated string table";
+		return false;
+	}
+	const char* strings = reader.Current();
+	if (!reader.Skip(stringSize)) {
+		error = "truncated string table";
+		return false;
+	}
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < stringCount && offset < stringSize; i++) {
+		const char* start = strings + offset;
+		const char* terminator = (const char*)memchr(start, '\0', stringSize - offset);
+		size_t length = terminator != NULL ? terminator - start : stringSize - offset;
+		info.StringOffsetToStringMap.emplace(offset, std::string(start, length));
+		offset += (uint32_t)length + 1;
+	}
+
+	MdlModelHeader modelHeader;
+	if (!reader.Read(modelHeader) || !reader.Skip(modelHeader.ElementIdCount * ElementIdSize)) {
+		error = "truncated model header";
+		return false;
+	}
+	info.MeshCount = modelHeader.MeshCount;
+	info.SubmeshCount = modelHeader.SubmeshCount;
+
+	int lodCount = std::min((int)fileHeader.LodCount, 3);
+	for (int lod = 0; lod < 3; lod++) {
+		MdlMeshLod meshLod;
+		if (!reader.Read(meshLod)) {
+			error = "truncated lods";
+			return false;
+		}
+		if (lod < lodCount) {
+			MdlLodInfo lodInfo;
+			lodInfo.MeshCount = meshLod.MeshCount;
+			lodInfo.VertexBufferSize = fileHeader.VertexBufferSize[lod];
+			lodInfo.IndexBufferSize = fileHeader.IndexBufferSize[lod];
+			lodInfo.PolygonCount = meshLod.PolygonCount;
+			info.Lods.push_back(lodInfo);
+		}
+	}
+
+	if ((modelHeader.Flags2 & ExtraLodEnabled) != 0 && !reader.Skip(3 * ExtraLodSize)) {
+		error = "truncated extra lods";
+		return false;
+	}
+
+	if (!reader.Skip(modelHeader.MeshCount * MeshSize)
+		|| !ReadNames(reader, modelHeader.AttributeCount, info, info.Attributes)
+		|| !reader.Skip(modelHeader.TerrainShadowMeshCount * TerrainShadowMeshSize)
+		|| !reader.Skip(modelHeader.SubmeshCount * SubmeshSize)
+		|| !reader.Skip(modelHeader.TerrainShadowSubmeshCount * TerrainShadowSubmeshSize)
+		|| !ReadNames(reader, modelHeader.MaterialCount, info, info.Materials)
+		|| !ReadNames(reader, modelHeader.BoneCount, info, info.Bones)) {
+		error = "truncated meshes and names";
+		return false;
+	}
+
+	// Version 6 bone tables are only as long as they need to be, with the bone lists padded to 4 bytes
+	size_t boneTableBytes = modelHeader.BoneTableCount * BoneTableSize;
+	if (fileHeader.Version == MdlVersion6) {
+		boneTableBytes = modelHeader.BoneTableCount * BoneTableHeaderSize + ((modelHeader.BoneTableArrayCountTotal * 2 + 3) & ~(size_t)3);
+	}
+	if (!reader.Skip(boneTableBytes)) {
+		error = "truncated bone tables";
+		return false;
+	}
+
+	for (int i = 0; i < modelHeader.ShapeCount; i++) {
+		MdlShape shape;
+		if (!reader.Read(shape)) {
+			error = "truncated shapes";
+			return false;
+		}
+		auto it = info.StringOffsetToStringMap.find(shape.StringOffset);
+		info.Shapes.push_back(it != info.StringOffsetToStringMap.end() ? it->second : std::string());
+	}
+	return true;
+}
+
+bool MdlCatalogue::ReadInfo(std::string mdlPath, MdlInfo& info, std::string& error) {
+	std::ifstream ifs(mdlPath, std::ios::binary | std::ios::ate);
+	size_t fileSize = ifs.is_open() ? (size_t)ifs.tellg() : 0;
+	ifs.seekg(0);
+	MdlFileHeader fileHeader;
+	if (!ifs.read((char*)&fileHeader, sizeof(fileHeader))) {
+		error = "could not read the mdl header";
+		return false;
+	}
+	// Checked before the sizes in the header are trusted for anything
+	if (fileHeader.Version != MdlVersion5 && fileHeader.Version != MdlVersion6) {
+		error = "unknown mdl version";
+		return false;
+	}
+
+	// Everything up to the vertex buffers; the geometry after it is never read. A damaged header can't ask for more than the file.
+	size_t headerSize = std::min((size_t)fileHeader.StackSize + fileHeader.RuntimeSize, fileSize - sizeof(fileHeader));
+	std::vector<char> data(sizeof(fileHeader) + headerSize);
+	memcpy(data.data(), &fileHeader, sizeof(fileHeader));
+	ifs.read(data.data() + sizeof(fileHeader), data.size() - sizeof(fileHeader));
+	data.resize(sizeof(fileHeader) + (size_t)ifs.gcount());
+	return ReadInfo(data.data(), data.size(), info, error);
+}
+
+static json ToJson(const MdlInfo& info) {
+	json lods = json::array();
+	for (int i = 0; i < info.Lods.size(); i++) {
+		lods.push_back({
+			{ "meshes", info.Lods[i].MeshCount },
+			{ "polygons", info.Lods[i].PolygonCount },
+			{ "vertex_bytes", info.Lods[i].VertexBufferSize },
+			{ "index_bytes", info.Lods[i].IndexBufferSize }
+		});
+	}
+
+	json j;
+	j["path"] = info.Path;
+	j["version"] = info.Version;
+	j["meshes"] = info.MeshCount;
+	j["submeshes"] = info.SubmeshCount;
+	j["lods"] = lods;
+	j["materials"] = info.Materials;
+	j["bones"] = info.Bones;
+	j["attributes"] = info.Attributes;
+	j["shapes"] = info.Shapes;
+	return j;
+}
+
+CatalogueResult MdlCatalogue::Build(std::string directory, std::string indexPath) {
+	CatalogueResult result;
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::string> paths;
+	std::error_code ec;
+	for (fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+		if (it->is_regular_file(ec) && it->path().extension() == ".mdl") {
+			paths.push_back(fs::relative(it->path(), directory, ec).generic_string());
+		}
+	}
+	std::sort(paths.begin(), paths.end());
+
+	std::vector<MdlInfo> infos(paths.size());
+	std::vector<char> indexed(paths.size(), 0);
+	std::atomic<int> nextFile(0);
+	auto work = [&]() {
+		int i;
+		while ((i = nextFile++) < (int)paths.size()) {
+			std::string error;
+			if (ReadInfo((fs::path(directory) / paths[i]).string(), infos[i], error)) {
+				infos[i].Path = paths[i];
+				indexed[i] = 1;
+			}
+			else {
+				Instrumentation::Log(LogLevel::Warning, "Could not index %s: %s", paths[i].c_str(), error.c_str());
+				infos[i] = MdlInfo();
+			}
+		}
+	};
+
+	int workers = std::min(threadCount, (int)paths.size());
+	std::vector<std::thread> threads;
+	for (int t = 1; t < workers; t++) {
+		threads.emplace_back(work);
+	}
+	if (workers > 0) {
+		work();
+	}
+	for (int t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+
+	// Write then rename, so a search never sees half an index
+	std::string tempPath = indexPath + ".tmp";
+	std::ofstream ofs(tempPath, std::ios::binary);
+	if (!ofs.is_open()) {
+		Instrumentation::Log(LogLevel::Error, "Could not write mdl index to %s", indexPath.c_str());
+		result.Failed = (int)paths.size();
+		return result;
+	}
+	for (int i = 0; i < infos.size(); i++) {
+		if (indexed[i]) {
+			ofs << ToJson(infos[i]).dump() << '\n';
+			result.Indexed++;
+		}
+		else {
+			result.Failed++;
+		}
+	}
+	ofs.close();
+	fs::rename(tempPath, indexPath, ec);
+	if (ec) {
+		Instrumentation::Log(LogLevel::Error, "Could not write mdl index to %s", indexPath.c_str());
+	}
+
+	result.TotalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	Instrumentation::Log(LogLevel::Info, "Indexed %i mdl files in %s, %i failed, in %.0f ms on %i threads", result.Indexed, directory.c_str(), result.Failed, result.TotalMilliseconds, workers);
+	return result;
+}
\ No newline at end of file
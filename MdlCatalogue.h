@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// The start of every mdl, before any of its data
+#pragma pack(push, 1)
+struct MdlFileHeader {
+	uint32_t Version;
+	uint32_t StackSize;
+	uint32_t RuntimeSize;
+	uint16_t VertexDeclarationCount;
+	uint16_t MaterialCount;
+	uint32_t VertexOffset[3];
+	uint32_t IndexOffset[3];
+	uint32_t VertexBufferSize[3];
+	uint32_t IndexBufferSize[3];
+	uint8_t LodCount;
+	uint8_t EnableIndexBufferStreaming;
+	uint8_t EnableEdgeGeometry;
+	uint8_t Padding;
+};
+#pragma pack(pop)
+
+struct MdlLodInfo {
+	int MeshCount = 0;
+	uint32_t VertexBufferSize = 0;
+	uint32_t IndexBufferSize = 0;
+	uint32_t PolygonCount = 0;
+};
+
+// What an mdl is made of, without any of its geometry
+struct MdlInfo {
+	// Relative to the catalogued directory when it comes from a catalogue
+	std::string Path;
+	uint32_t Version = 0;
+	int MeshCount = 0;
+	int SubmeshCount = 0;
+	std::vector<MdlLodInfo> Lods;
+	std::map<uint32_t, std::string> StringOffsetToStringMap;
+	std::vector<std::string> Materials;
+	std::vector<std::string> Bones;
+	std::vector<std::string> Attributes;
+	std::vector<std::string> Shapes;
+};
+
+struct CatalogueResult {
+	int Indexed = 0;
+	int Failed = 0;
+	double TotalMilliseconds = 0;
+};
+
+// Indexes every mdl under a directory by reading only the file header and the model header after it: the
+// string table, counts, lods and name offsets. Vertex and index buffers are never read, so a whole game
+// export can be searched for a material, bone or shape in seconds.
+class MdlCatalogue
+{
+public:
+	// 0 uses one thread per core
+	MdlCatalogue(int threadCount = 0);
+
+	// Writes one line of json per mdl to indexPath, sorted by path
+	CatalogueResult Build(std::string directory, std::string indexPath);
+
+	// False, with the reason in error, if the data isn't an mdl this can read
+	static bool ReadInfo(const char* data, size_t size, MdlInfo& info, std::string& error);
+	// Reads the header part of the file only
+	static bool ReadInfo(std::string mdlPath, MdlInfo& info, std::string& error);
+
+private:
+	int threadCount;
+};
\ No newline at end of file
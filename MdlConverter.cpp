@@ -1,6 +1,17 @@
 #include "MdlConverter.h"
 #include "MdlToFbxConverter.h"
+#include "ConversionBenchmark.h"
+#include "BatchConverter.h"
+#include "BatchImporter.h"
+#include "ConverterServer.h"
+#include "MemoryBudgetScheduler.h"
+#include "MdlCatalogue.h"
+#include "Instrumentation.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <io.h>
+#include <fcntl.h>
+#include <iostream>
 
 int ConvertToFbx(const wchar_t* wideStr)
 {
@@ -23,4 +34,155 @@ int ConvertToFbxWithOutput(const wchar_t* mdlFilePath, const wchar_t* outputPath
 	wcstombs_s(&outputCharsConverted, outputBuffer, 500, outputPath, 500);
 	MdlToFbxConverter converter(mdlBuffer, outputBuffer);
 	return 0;
+}
+
+int ConvertToFbxWithLods(const wchar_t* mdlFilePath, const wchar_t* outputPath, int lodMode)
+{
+	char mdlBuffer[500];
+	char outputBuffer[500];
+	size_t mdlCharsConverted = 0;
+	size_t outputCharsConverted = 0;
+
+	if (lodMode < (int)LodExportMode::DefaultLod || lodMode > (int)LodExportMode::SeparateFiles) {
+		return -1;
+	}
+	wcstombs_s(&mdlCharsConverted, mdlBuffer, 500, mdlFilePath, 500);
+	wcstombs_s(&outputCharsConverted, outputBuffer, 500, outputPath, 500);
+
+	ExportOptions options;
+	options.LodMode = (LodExportMode)lodMode;
+	MdlToFbxConverter converter(mdlBuffer, outputBuffer, options);
+	return converter.GetExportStatus();
+}
+
+int RunConversionBenchmark(const wchar_t* outputJsonPath, int vertexCount, int partCount, int shapeCount, int boneCount, int iterations)
+{
+	char outputBuffer[500];
+	size_t outputCharsConverted = 0;
+	wcstombs_s(&outputCharsConverted, outputBuffer, 500, outputJsonPath, 500);
+
+	BenchmarkConfig config;
+	config.VertexCount = vertexCount;
+	config.PartCount = partCount;
+	config.ShapeCount = shapeCount;
+	config.BoneCount = boneCount;
+	config.Iterations = iterations;
+
+	ConversionBenchmark benchmark(config);
+	return benchmark.WriteResults(outputBuffer);
+}
+
+void SetLogLevel(int level)
+{
+	Instrumentation::SetLogLevel((LogLevel)level);
+}
+
+void SetReportFile(const wchar_t* reportFilePath)
+{
+	char buffer[500];
+	size_t charsConverted = 0;
+	wcstombs_s(&charsConverted, buffer, 500, reportFilePath, 500);
+	Instrumentation::SetReportFile(buffer);
+}
+
+int ConvertBatch(const wchar_t** mdlFilePaths, const wchar_t** outputPaths, int count, const wchar_t* cacheDirectory)
+{
+	char buffer[500];
+	size_t charsConverted = 0;
+	std::vector<BatchJob> jobs;
+
+	for (int i = 0; i < count; i++) {
+		BatchJob job;
+		wcstombs_s(&charsConverted, buffer, 500, mdlFilePaths[i], 500);
+		job.MdlPath = buffer;
+		wcstombs_s(&charsConverted, buffer, 500, outputPaths[i], 500);
+		job.OutputPath = buffer;
+		jobs.push_back(job);
+	}
+
+	BatchOptions options;
+	if (cacheDirectory != NULL) {
+		wcstombs_s(&charsConverted, buffer, 500, cacheDirectory, 500);
+		options.CacheDirectory = buffer;
+	}
+
+	BatchConverter converter(options);
+	return converter.Run(jobs).Failed;
+}
+
+int ConvertBatchWithMemoryBudget(const wchar_t** mdlFilePaths, const wchar_t** outputPaths, int count, int budgetMegabytes, int threadCount)
+{
+	char buffer[500];
+	size_t charsConverted = 0;
+	std::vector<BatchJob> jobs;
+
+	for (int i = 0; i < count; i++) {
+		BatchJob job;
+		wcstombs_s(&charsConverted, buffer, 500, mdlFilePaths[i], 500);
+		job.MdlPath = buffer;
+		wcstombs_s(&charsConverted, buffer, 500, outputPaths[i], 500);
+		job.OutputPath = buffer;
+		jobs.push_back(job);
+	}
+
+	MemoryBudgetScheduler scheduler(ExportOptions(), (unsigned long long)budgetMegabytes * 1024 * 1024, threadCount);
+	return scheduler.Run(jobs).Failed;
+}
+
+int BuildMdlCatalogue(const wchar_t* directory, const wchar_t* indexPath, int threadCount)
+{
+	char directoryBuffer[500];
+	char indexBuffer[500];
+	size_t directoryCharsConverted = 0;
+	size_t indexCharsConverted = 0;
+
+	wcstombs_s(&directoryCharsConverted, directoryBuffer, 500, directory, 500);
+	wcstombs_s(&indexCharsConverted, indexBuffer, 500, indexPath, 500);
+
+	MdlCatalogue catalogue(threadCount);
+	return catalogue.Build(directoryBuffer, indexBuffer).Failed;
+}
+
+int ImportFbxBatch(const wchar_t** fbxFilePaths, int count, int threadCount)
+{
+	char buffer[500];
+	size_t charsConverted = 0;
+	std::vector<std::string> paths;
+
+	for (int i = 0; i < count; i++) {
+		wcstombs_s(&charsConverted, buffer, 500, fbxFilePaths[i], 500);
+		paths.push_back(buffer);
+	}
+
+	BatchImporter importer(threadCount);
+	return importer.Run(paths).Failed;
+}
+
+int ConvertToGlb(const wchar_t* mdlFilePath, const wchar_t* outputPath)
+{
+	char mdlBuffer[500];
+	char outputBuffer[500];
+	size_t mdlCharsConverted = 0;
+	size_t outputCharsConverted = 0;
+
+	wcstombs_s(&mdlCharsConverted, mdlBuffer, 500, mdlFilePath, 500);
+	wcstombs_s(&outputCharsConverted, outputBuffer, 500, outputPath, 500);
+
+	ExportOptions options;
+	options.Format = ExportFormat::Glb;
+	MdlToFbxConverter converter(mdlBuffer, outputBuffer, options);
+	return converter.GetExportStatus();
+}
+
+int RunConverterServer(int workerCount)
+{
+	// stdout carries the responses, so nothing else can be written to it
+	Instrumentation::SetLogCallback([](LogLevel level, const std::string& message) {
+		fprintf(stderr, "%s\n", message.c_str());
+	});
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+
+	ConverterServer server(ExportOptions(), workerCount);
+	return server.Serve(std::cin, std::cout);
 }
\ No newline at end of file
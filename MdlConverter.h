@@ -4,4 +4,30 @@
 extern "C" {
 	__declspec(dllexport) int ConvertToFbx(const wchar_t* mdlFilePath);
 	__declspec(dllexport) int ConvertToFbxWithOutput(const wchar_t* mdlFilePath, const wchar_t* outputPath);
-}
+	// lodMode: 0 = default lod only, 1 = every lod in an FbxLODGroup, 2 = every lod in its own file.
+	// Returns 0 if every file was written, -1 otherwise or for an unknown lodMode.
+	__declspec(dllexport) int ConvertToFbxWithLods(const wchar_t* mdlFilePath, const wchar_t* outputPath, int lodMode);
+	// Writes binary glTF instead of FBX
+	__declspec(dllexport) int ConvertToGlb(const wchar_t* mdlFilePath, const wchar_t* outputPath);
+	// Skips any mdl whose contents, skeleton and options are unchanged since it was last converted into cacheDirectory.
+	// Returns the number of jobs that failed.
+	__declspec(dllexport) int ConvertBatch(const wchar_t** mdlFilePaths, const wchar_t** outputPaths, int count, const wchar_t* cacheDirectory);
+	// Converts on threadCount threads (0 = one per core), only starting a job once the memory of the running ones
+	// leaves room for it. Returns the number of jobs that failed.
+	__declspec(dllexport) int ConvertBatchWithMemoryBudget(const wchar_t** mdlFilePaths, const wchar_t** outputPaths, int count, int budgetMegabytes, int threadCount);
+	// Writes one line of json per mdl under directory to indexPath, with its materials, bones, attributes, shapes and
+	// lod sizes, read from the headers only. Runs on threadCount threads (0 = one per core). Returns the number of files that failed.
+	__declspec(dllexport) int BuildMdlCatalogue(const wchar_t* directory, const wchar_t* indexPath, int threadCount);
+	// Imports fbx files on threadCount threads (0 = one per core). Each file's report goes to the report file.
+	// Returns the number of files that failed.
+	__declspec(dllexport) int ImportFbxBatch(const wchar_t** fbxFilePaths, int count, int threadCount);
+	// Serves conversion requests framed as described in ConverterServer.h over stdin and stdout until stdin closes
+	// or a shutdown request. Logs go to stderr. Returns the number of requests that failed.
+	__declspec(dllexport) int RunConverterServer(int workerCount);
+	// level: 0 = debug, 1 = info, 2 = warning, 3 = error, 4 = none
+	__declspec(dllexport) void SetLogLevel(int level);
+	// Every conversion appends a line of json with its stage timings and counters to this file
+	__declspec(dllexport) void SetReportFile(const wchar_t* reportFilePath);
+	// Converts generated models and writes the time spent in each stage to a json file
+	__declspec(dllexport) int RunConversionBenchmark(const wchar_t* outputJsonPath, int vertexCount, int partCount, int shapeCount, int boneCount, int iterations);
+}
\ No newline at end of file
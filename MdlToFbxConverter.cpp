@@ -1,11 +1,19 @@
 #include "MdlToFbxConverter.h"
 #include <regex>
+#include <fstream>
 #include "Eigen/Dense"
+#include "Instrumentation.h"
+#include "GlbWriter.h"
+#include "FbxMemoryStream.h"
 
 // Pretty much entirely from https://github.com/TexTools/TT_FBX_Reader/blob/master/TT_FBX/src/db_converter.cpp
-MdlToFbxConverter::MdlToFbxConverter(const char* mdlFilePath, const char* outputPath) {
-	fprintf(stdout, "Converting %s to %s\n", mdlFilePath, outputPath);
+MdlToFbxConverter::MdlToFbxConverter(const char* mdlFilePath, const char* outputPath, ExportOptions options) {
+	Instrumentation::BeginReport(mdlFilePath);
+	Instrumentation::Log(LogLevel::Info, "Converting %s to %s", mdlFilePath, outputPath);
 	this->outputPath = outputPath;
+	this->mdlPath = mdlFilePath;
+	this->options = options;
+	SetArena(options.Arena);
 
 	//mdlFile = new MdlFile();
 	//mdlFile->LoadFromFile(mdlFilePath);
@@ -17,16 +25,51 @@ MdlToFbxConverter::MdlToFbxConverter(const char* mdlFilePath, const char* output
 
 	model = new Model(mdlFile);
 
+	if (options.Format == ExportFormat::Glb) {
+		// Nothing from the FBX SDK is needed to write a glb
+		ExportGlb();
+	}
+	else {
+		manager = options.Manager;
+		if (manager == NULL) {
+			manager = FbxManager::Create();
+
+			FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
+			manager->SetIOSettings(ios);
+		}
+
+		if (options.LodMode == LodExportMode::DefaultLod) {
+			CreateScene(model);
+			exportStatus = ExportScene(this->outputPath);
+		}
+		else {
+			ExportLods();
+		}
+
+		if (options.Manager == NULL) {
+			scene->Destroy();
+			manager->Destroy();
+		}
+		else {
+			// The manager outlives this conversion, so everything the scene holds has to go with it
+			scene->Destroy(true);
+		}
+	}
+	arena->Release();
+	Instrumentation::EndReport();
+}
+
+// Only sets up the manager; the caller drives the conversion itself
+MdlToFbxConverter::MdlToFbxConverter() {
+	mdlFile = NULL;
+	model = NULL;
+	scene = NULL;
+	SetArena(NULL);
+
 	manager = FbxManager::Create();
 
 	FbxIOSettings* ios = FbxIOSettings::Create(manager, IOSROOT);
 	manager->SetIOSettings(ios);
-
-	CreateScene(model);
-	ExportScene();
-
-	scene->Destroy();
-	manager->Destroy();
 }
 
 MdlToFbxConverter::~MdlToFbxConverter() {
@@ -34,56 +77,67 @@ MdlToFbxConverter::~MdlToFbxConverter() {
 	delete model;
 }
 
+void MdlToFbxConverter::SetArena(ScratchArena* externalArena) {
+	if (externalArena != NULL) {
+		arena = externalArena;
+	}
+	else {
+		ownedArena.reset(new ScratchArena());
+		arena = ownedArena.get();
+	}
+}
+
 void MdlToFbxConverter::SetSkeletonFromFile(std::string filePath)
 {
+	n_root = Skeleton::BuildSkeletonFromFile(filePath);
+}
+
+int MdlToFbxConverter::GetExportStatus() {
+	return exportStatus;
+}
+
+std::vector<std::string> MdlToFbxConverter::GetWrittenFiles() {
+	return writtenFiles;
 }
 
 void MdlToFbxConverter::SetSkeletonFromData(const char* data)
 {
+	n_root = Skeleton::BuildSkeletonFromData(data);
 }
 
-std::string GetSkeletonFileName(std::string path) {
-	// MdlFile and Model do not inherently know the path that they are assigned to
-	std::regex equipRegex("(c[0-9]{4})");
-	std::smatch match;
-	if (std::regex_search(path, match, equipRegex)) {
-		return "..\\Skeletons\\" + match.begin()->str() + "b0001.skel";
+std::string GetLodOutputPath(std::string path, int lod) {
+	std::string suffix = "_lod" + std::to_string(lod);
+	size_t extension = path.find_last_of('.');
+	size_t separator = path.find_last_of("\\/");
+	if (extension == std::string::npos || (separator != std::string::npos && extension < separator)) {
+		return path + suffix;
 	}
-	return "..\\Skeletons\\c0101b0001.skel";
+	return path.substr(0, extension) + suffix + path.substr(extension);
 }
 
-void MdlToFbxConverter::CreateScene(Model* model) {
-	scene = FbxScene::Create(manager, "fbx export");
-	FbxNode* root = scene->GetRootNode();
-
-	// Initialize axis
-	auto up = FbxAxisSystem::EUpVector::eYAxis;
-	auto front = FbxAxisSystem::EFrontVector::eParityOdd;
-	auto handedness = FbxAxisSystem::eRightHanded;
-
-	FbxAxisSystem dbAxis(up, front, handedness);
-	dbAxis.ConvertScene(scene);
-
-	scene->GetGlobalSettings().SetSystemUnit(FbxSystemUnit::m);
-
-	FbxNode* firstNode = FbxNode::Create(manager, "root name");
-	FbxDouble3 rootScale = firstNode->LclScaling.Get();
-	root->AddChild(firstNode);
-
-	std::string fileName = GetSkeletonFileName(model->Materials[0].MaterialPath);
+// Loads the skeleton and resolves the model's bone names against it. Only done once per conversion.
+void MdlToFbxConverter::LoadSkeleton() {
+	if (BoneNameToBone.size() > 0) {
+		return;
+	}
 
 	// TODO: Build a skeleton from something other than a file that came from TexTools
-	// TODO: Faces do not work completely because they have bones that are in a separate file from b0001
-	n_root = Skeleton::BuildSkeletonFromFile("..\\Skeletons\\c0101b0001.skel");
-	FbxPose* pose = FbxPose::Create(manager, "Bindpose");
-	pose->SetIsBindPose(true);
-
+	if (n_root == NULL) {
+		std::string bodyPath = Skeleton::GetBodySkeletonPath(mdlPath, options.SkeletonPath);
+		std::vector<std::string> supplementaryPaths = options.SupplementarySkeletonPaths;
+		if (supplementaryPaths.size() == 0) {
+			supplementaryPaths = Skeleton::GetSupplementarySkeletonPaths(mdlPath, bodyPath);
+		}
+		// Shared with every other conversion that uses the same skeletons
+		sharedSkeleton = Skeleton::BuildMergedSkeleton(bodyPath, supplementaryPaths);
+		n_root = sharedSkeleton.get();
+	}
 	if (n_root == NULL) {
 		// Create a skeleton where every bone is the identity matrix
 		// This is theoretically a failsafe to make sure the weights are actually set later on
 		
 		// TODO: Find better method to make sure weights are actually painted?
-		fprintf(stderr, "Could not get skeleton.\nCreating empty skeleton.\n");
+		Instrumentation::Log(LogLevel::Warning, "Could not get skeleton. Creating empty skeleton.");
 		n_root = new Bone("n_root");
 		std::map<int, std::string>::iterator it;
 		int boneNameIndex = 0;
@@ -98,22 +152,329 @@ void MdlToFbxConverter::CreateScene(Model* model) {
 				boneNameIndex++;
 			}
 		}
+		Skeleton::ComputeWorldMatrices(n_root);
 	}
-	AddBoneToScene(n_root, pose, firstNode);
-	scene->AddPose(pose);
+	// Skeletons from the cache are shared between threads and already have their world matrices, so they are only read here
+	BuildBoneLookup(n_root);
+	BuildModelBones(model);
+}
+
+// Creates the scene along with everything that is shared between lods: the skeleton, bind pose, and materials
+void MdlToFbxConverter::InitScene() {
+	scene = FbxScene::Create(manager, "fbx export");
+	FbxNode* root = scene->GetRootNode();
+
+	// Initialize axis
+	auto up = FbxAxisSystem::EUpVector::eYAxis;
+	auto front = FbxAxisSystem::EFrontVector::eParityOdd;
+	auto handedness = FbxAxisSystem::eRightHanded;
+
+	FbxAxisSystem dbAxis(up, front, handedness);
+	dbAxis.ConvertScene(scene);
+
+	scene->GetGlobalSettings().SetSystemUnit(FbxSystemUnit::m);
+
+	rootNode = FbxNode::Create(manager, "root name");
+	FbxDouble3 rootScale = rootNode->LclScaling.Get();
+	root->AddChild(rootNode);
+
+	LoadSkeleton();
+
+	bindPose = FbxPose::Create(manager, "Bindpose");
+	bindPose->SetIsBindPose(true);
+
+	AddBoneToScene(n_root, bindPose, rootNode);
+	scene->AddPose(bindPose);
 
 	CreateMaterials();
+}
+
+void MdlToFbxConverter::CreateScene(Model* model) {
+	ScopedTimer timer("CreateScene");
+	InitScene();
+	AddModelToScene(model, rootNode);
+	bindPose->Add(rootNode, rootNode->EvaluateGlobalTransform());
+}
 
+void MdlToFbxConverter::AddModelToScene(Model* model, FbxNode* parent) {
 	for (int i = 0; i < model->Meshes.size(); i++) {
+		Mesh* group = &model->Meshes[i];
+		std::vector<int> selectedParts = GetSelectedParts(group);
+		if (selectedParts.size() == 0) {
+			continue;
+		}
+
 		FbxNode* node = FbxNode::Create(manager, ("Group " + std::to_string(i)).c_str());
-		firstNode->AddChild(node);
+		parent->AddChild(node);
+
+		bindPose->Add(node, node->EvaluateGlobalTransform());
+		for (int j = 0; j < selectedParts.size(); j++) {
+			int p = selectedParts[j];
+			AddPartToScene(group, &group->Submeshes[p], node, group->Submeshes[0].IndexOffset, p);
+		}
+	}
+}
+
+// The parts of a mesh that pass the export filter. A mesh with none of them doesn't get a node at all.
+std::vector<int> MdlToFbxConverter::GetSelectedParts(Mesh* group) {
+	std::vector<int> selectedParts;
+	const PartFilter& filter = options.Filter;
+	if (!filter.IncludesMesh(group)) {
+		return selectedParts;
+	}
+
+	for (int p = 0; p < group->Submeshes.size(); p++) {
+		if (filter.IncludesPart(group, &group->Submeshes[p], p)) {
+			selectedParts.push_back(p);
+		}
+	}
+	return selectedParts;
+}
+
+void MdlToFbxConverter::ExportGlb() {
+	{
+		ScopedTimer timer("CreateScene");
+		LoadSkeleton();
+	}
+
+	int lodCount = 1;
+	if (options.LodMode != LodExportMode::DefaultLod) {
+		if (options.LodMode == LodExportMode::LodGroup) {
+			Instrumentation::Log(LogLevel::Warning, "glb has no lod groups, writing each lod to its own file");
+		}
+		lodCount = mdlFile->FileHeader.LodCount;
+		if (lodCount < 1) {
+			lodCount = 1;
+		}
+	}
+
+	for (int lod = 0; lod < lodCount; lod++) {
+		Model* lodModel = model;
+		GlbWriter writer;
+		{
+			// Writing the file is timed by ExportScene
+			ScopedTimer timer("CreateScene");
+			if (lod > 0) {
+				lodModel = new Model(mdlFile, (Model::ModelLod)lod);
+			}
+			if (options.LodMode != LodExportMode::DefaultLod) {
+				modelName = "LOD" + std::to_string(lod);
+			}
+
+			writer.AddSkeleton(n_root, ModelBones);
+			AddModelToGlb(lodModel, writer);
+		}
+
+		std::string path = options.LodMode == LodExportMode::DefaultLod ? outputPath : GetLodOutputPath(outputPath, lod);
+		if (options.OutputSink) {
+			std::vector<char> data;
+			writer.Serialize(data);
+			options.OutputSink(path, std::move(data));
+			writtenFiles.push_back(path);
+		}
+		else if (writer.Write(path) != 0) {
+			exportStatus = -1;
+		}
+		else {
+			writtenFiles.push_back(path);
+		}
+
+		if (lodModel != model) {
+			delete lodModel;
+		}
+		arena->Release();
+	}
+}
+
+// Same preparation as AddPartToScene, handed to the glb writer instead of the FBX SDK
+void MdlToFbxConverter::AddModelToGlb(Model* model, GlbWriter& writer) {
+	for (int i = 0; i < model->Meshes.size(); i++) {
+		Mesh* group = &model->Meshes[i];
+		std::vector<int> selectedParts = GetSelectedParts(group);
+		if (selectedParts.size() == 0) {
+			continue;
+		}
+
+		writer.AddGroup("Group " + std::to_string(i));
+		int indicesOffset = group->Submeshes[0].IndexOffset;
+
+		for (int j = 0; j < selectedParts.size(); j++) {
+			ScopedTimer timer("AddPartToScene");
+			int p = selectedParts[j];
+			Submesh* part = &group->Submeshes[p];
+
+			PartVertices partVertices(arena, options.PackVertexStreams);
+			GetUniquePartVertices(group, part, indicesOffset, partVertices);
+			ResolvePartShapes(group, part, indicesOffset, partVertices);
+
+			writer.AddPart(modelName + " Part " + std::to_string(group->MeshIndex) + "." + std::to_string(p), group, partVertices);
+		}
+	}
+}
+
+bool PartFilter::IncludesMesh(Mesh* group) const {
+	if (MeshIndices.size() > 0 && std::find(MeshIndices.begin(), MeshIndices.end(), (int)group->MeshIndex) == MeshIndices.end()) {
+		return false;
+	}
+	if (MaterialPaths.size() > 0) {
+		if (group->Material == NULL) {
+			return false;
+		}
+		if (std::find(MaterialPaths.begin(), MaterialPaths.end(), group->Material->MaterialPath) == MaterialPaths.end()) {
+			return false;
+		}
+	}
+	return true;
+}
 
-		pose->Add(node, node->EvaluateGlobalTransform());
-		for (int p = 0; p < model->Meshes[i].Submeshes.size(); p++) {
-			AddPartToScene(&model->Meshes[i], &model->Meshes[i].Submeshes[p], node, model->Meshes[i].Submeshes[0].IndexOffset, p);
+bool PartFilter::IncludesPart(Mesh* group, Submesh* part, int partNumber) const {
+	if (!IncludesMesh(group)) {
+		return false;
+	}
+	if (PartIndices.size() > 0 && std::find(PartIndices.begin(), PartIndices.end(), partNumber) == PartIndices.end()) {
+		return false;
+	}
+	if (AttributeMask != 0 && (part->AttributeIndexMask & AttributeMask) == 0) {
+		return false;
+	}
+	return true;
+}
+
+// Exports every lod in the mdl, reusing the skeleton, materials, and bone lookups that were built for the first one
+void MdlToFbxConverter::ExportLods() {
+	int lodCount = mdlFile->FileHeader.LodCount;
+	if (lodCount < 1) {
+		lodCount = 1;
+	}
+
+	// CreateScene only times building the scene; the exports in between are timed by ExportScene
+	FbxNode* lodGroupNode = NULL;
+	{
+		ScopedTimer timer("CreateScene");
+		InitScene();
+		bindPose->Add(rootNode, rootNode->EvaluateGlobalTransform());
+
+		if (options.LodMode == LodExportMode::LodGroup) {
+			lodGroupNode = FbxNode::Create(manager, "LOD Group");
+			FbxLODGroup* lodGroup = FbxLODGroup::Create(scene, "LOD Group Attribute");
+			lodGroup->ThresholdsUsedAsPercentage.Set(true);
+			for (int lod = 1; lod < lodCount; lod++) {
+				lodGroup->AddThreshold(100.0 - (100.0 * lod / lodCount));
+			}
+			lodGroupNode->SetNodeAttribute(lodGroup);
+			rootNode->AddChild(lodGroupNode);
+			bindPose->Add(lodGroupNode, lodGroupNode->EvaluateGlobalTransform());
+		}
+	}
+
+	for (int lod = 0; lod < lodCount; lod++) {
+		Model* lodModel = model;
+		FbxNode* lodNode = NULL;
+		{
+			ScopedTimer timer("CreateScene");
+			if (lod > 0) {
+				lodModel = new Model(mdlFile, (Model::ModelLod)lod);
+			}
+			modelName = "LOD" + std::to_string(lod);
+
+			lodNode = FbxNode::Create(manager, modelName.c_str());
+			if (options.LodMode == LodExportMode::LodGroup) {
+				lodGroupNode->AddChild(lodNode);
+			}
+			else {
+				rootNode->AddChild(lodNode);
+			}
+			bindPose->Add(lodNode, lodNode->EvaluateGlobalTransform());
+			AddModelToScene(lodModel, lodNode);
+		}
+
+		if (options.LodMode != LodExportMode::LodGroup) {
+			if (ExportScene(GetLodOutputPath(outputPath, lod)) != 0) {
+				exportStatus = -1;
+			}
+
+			// Only the lod's own meshes get thrown away, the skeleton and materials stay for the next one
+			RemoveNodeFromScene(lodNode);
+		}
+
+		if (lodModel != model) {
+			delete lodModel;
+		}
+		// Nothing built for this lod needs its scratch data any more
+		arena->Release();
+	}
+
+	if (options.LodMode == LodExportMode::LodGroup) {
+		exportStatus = ExportScene(outputPath);
+	}
+}
+
+// Destroys a node and everything that was created for it, so it is not written out with the next export
+void MdlToFbxConverter::RemoveNodeFromScene(FbxNode* node) {
+	for (int i = node->GetChildCount() - 1; i >= 0; i--) {
+		RemoveNodeFromScene(node->GetChild(i));
+	}
+
+	int poseIndex = bindPose->Find(node);
+	if (poseIndex >= 0) {
+		bindPose->Remove(poseIndex);
+	}
+
+	FbxMesh* mesh = node->GetMesh();
+	if (mesh != NULL) {
+		for (int i = mesh->GetDeformerCount() - 1; i >= 0; i--) {
+			FbxDeformer* d = mesh->GetDeformer(i);
+			if (d->GetDeformerType() == FbxDeformer::eSkin) {
+				FbxSkin* skin = (FbxSkin*)d;
+				for (int c = skin->GetClusterCount() - 1; c >= 0; c--) {
+					skin->GetCluster(c)->Destroy();
+				}
+			}
+			else if (d->GetDeformerType() == FbxDeformer::eBlendShape) {
+				FbxBlendShape* blendShape = (FbxBlendShape*)d;
+				for (int c = blendShape->GetBlendShapeChannelCount() - 1; c >= 0; c--) {
+					FbxBlendShapeChannel* channel = blendShape->GetBlendShapeChannel(c);
+					for (int t = channel->GetTargetShapeCount() - 1; t >= 0; t--) {
+						channel->GetTargetShape(t)->Destroy();
+					}
+					channel->Destroy();
+				}
+			}
+			d->Destroy();
+		}
+		mesh->Destroy();
+	}
+
+	if (node->GetParent() != NULL) {
+		node->GetParent()->RemoveChild(node);
+	}
+	node->Destroy();
+}
+
+void MdlToFbxConverter::BuildBoneLookup(Bone* bone) {
+	if (bone == NULL) return;
+
+	BoneNameToBone.emplace(bone->Name, bone);
+	for (int i = 0; i < bone->Children.size(); i++) {
+		BuildBoneLookup(bone->Children[i]);
+	}
+}
+
+// The bone names are the same for every lod, so they only need to be looked up once
+void MdlToFbxConverter::BuildModelBones(Model* model) {
+	ModelBones.clear();
+
+	std::map<int, std::string>::iterator it;
+	for (it = model->StringOffsetToStringMap.begin(); it != model->StringOffsetToStringMap.end(); it++) {
+		std::string boneName = it->second;
+		auto boneIt = BoneNameToBone.find(boneName);
+
+		if (boneIt == BoneNameToBone.end()) {
+			Instrumentation::Log(LogLevel::Debug, "Continuing on: %s", boneName.c_str());
+			continue;
 		}
+		ModelBones.push_back(boneIt->second);
 	}
-	pose->Add(firstNode, firstNode->EvaluateGlobalTransform());
 }
 
 FbxDouble3 MatrixToScale(Eigen::Transform<double, 3, Eigen::Affine> affineMatrix) {
@@ -129,6 +490,15 @@ FbxDouble3 MatrixToScale(Eigen::Transform<double, 3, Eigen::Affine> affineMatrix
 	return ret;
 }
 
+// FBX matrices are row vector, so this is Eigen's transposed
+FbxAMatrix ToFbxMatrix(const Eigen::Matrix4d& m) {
+	FbxAMatrix ret;
+	for (int row = 0; row < 4; row++) {
+		ret.SetRow(row, FbxVector4(m(0, row), m(1, row), m(2, row), m(3, row)));
+	}
+	return ret;
+}
+
 void MdlToFbxConverter::AddBoneToScene(Bone* bone, FbxPose* bindPose, FbxNode* parentNode) {
 	// TODO: Bones seem to be in position, but all facing the wrong directions (seems to be "outwards")
 	if (bone == NULL) return;
@@ -163,7 +533,8 @@ void MdlToFbxConverter::AddBoneToScene(Bone* bone, FbxPose* bindPose, FbxNode* p
 	node->LclScaling.Set(scale);
 
 	parentNode->AddChild(node);
-	bindPose->Add(node, node->EvaluateGlobalTransform());
+	// Same as node->EvaluateGlobalTransform(), since the root node is the identity, without the SDK walking the hierarchy
+	bindPose->Add(node, FbxMatrix(ToFbxMatrix(bone->WorldMatrix)));
 
 	for (int i = 0; i < bone->Children.size(); i++) {
 		AddBoneToScene(bone->Children[i], bindPose, node);
@@ -202,7 +573,7 @@ void MdlToFbxConverter::CreateMaterials() {
 				texture = FbxFileTexture::Create(scene, std::string(mat.MaterialPath + " Normal").c_str());
 			}
 			else {
-				fprintf(stderr, "Could not create FbxFileTexture from usage: %i\n", tex.TextureUsageSimple);
+				Instrumentation::Log(LogLevel::Warning, "Could not create FbxFileTexture from usage: %i", tex.TextureUsageSimple);
 			}
 			// TODO: Not sure about these two
 			// Emissive
@@ -237,147 +608,179 @@ bool CompareShape(const Shape* lhs, const Shape* rhs) {
 }
 
 void MdlToFbxConverter::AddPartToScene(Mesh* group, Submesh* part, FbxNode* parent, int indicesOffset, int partNumber) {
-	std::string modelName = "model name";
-	std::string partName = std::string(modelName + " Part " + std::to_string(group->MeshIndex) + "." + std::to_string(partNumber));
+	ScopedTimer timer("AddPartToScene");
+	std::pmr::string partName = arena->Concat({ modelName, " Part ", std::to_string(group->MeshIndex), ".", std::to_string(partNumber) });
 
 	FbxNode* node = FbxNode::Create(manager, partName.c_str());
 	bool success = parent->AddChild(node);
-	FbxSurfaceMaterial* lMaterial = NULL;
+	FbxSurfaceMaterial* lMaterial = GetSurfaceMaterial(group);
 
+	PartVertices partVertices(arena, options.PackVertexStreams);
+	GetUniquePartVertices(group, part, indicesOffset, partVertices);
+
+	FbxMesh* mesh = MakeMesh(partVertices.Vertices, partVertices.Indices, arena->Concat({ partName, " Mesh Attribute" }).c_str(), node, lMaterial);
+
+	ResolvePartShapes(group, part, indicesOffset, partVertices);
+	AddShapesToMesh(partVertices, mesh, partName);
+	AddSkinToMesh(group, partVertices, mesh, node, partName);
+
+	FbxMatrix bind = node->EvaluateGlobalTransform();
+	bindPose->Add(node, bind);
+}
+
+FbxSurfaceMaterial* MdlToFbxConverter::GetSurfaceMaterial(Mesh* group) {
 	std::map<std::string, FbxSurfaceMaterial*>::iterator it = MaterialPathToSurfaceMaterial.find(group->Material->MaterialPath);
 	if (it != MaterialPathToSurfaceMaterial.end()) {
-		lMaterial = it->second;
-	}
-	else {
-		lMaterial = FbxSurfacePhong::Create(scene, "material name");
-		fprintf(stderr, "Could not find material: %s\n", group->Material->MaterialPath.c_str());
+		return it->second;
 	}
+	Instrumentation::Log(LogLevel::Warning, "Could not find material: %s", group->Material->MaterialPath.c_str());
+	return FbxSurfacePhong::Create(scene, "material name");
+}
 
-	std::vector<Vertex> uniquePartVertices;
-	std::vector<uint16_t> uniquePartVerticesIndices;	// This is so I just compare the vertex indices
-	std::vector<uint16_t> indicesToUniqueVertices;
-	std::map<uint16_t, uint16_t> oldIndicesToNewIndices;
+// Get a list of unique vertices that belong to this part
+void MdlToFbxConverter::GetUniquePartVertices(Mesh* group, Submesh* part, int indicesOffset, PartVertices& partVertices) {
+	std::pmr::vector<uint32_t> uniquePartVerticesIndices(arena);	// This is so I just compare the vertex indices
+	partVertices.Vertices.Reserve(part->IndexNum / 2);
 
-	// Get a list of unique vertices that belong to this part
+	// Positions in the mesh's index buffer go past 65535 on dense meshes even though every index fits in 16 bits
 	for (uint32_t i = 0; i < part->IndexNum; i++) {
-		uint16_t currIndex = part->IndexOffset - indicesOffset + i;
-		uint16_t vertexNum = group->Indices[currIndex];
+		uint32_t currIndex = part->IndexOffset - indicesOffset + i;
+		uint32_t vertexNum = group->Indices[currIndex];
 
 		auto it = std::find(uniquePartVerticesIndices.begin(), uniquePartVerticesIndices.end(), vertexNum);
 		int existingIndex = it - uniquePartVerticesIndices.begin();
 
 		if (it != uniquePartVerticesIndices.end()) {
-			indicesToUniqueVertices.push_back(existingIndex);
-			oldIndicesToNewIndices.emplace(currIndex, existingIndex);
+			partVertices.Indices.push_back(existingIndex);
+			partVertices.OldIndicesToNewIndices.emplace(currIndex, existingIndex);
 		}
 		else {
 			uint16_t size = uniquePartVerticesIndices.size();
-			indicesToUniqueVertices.push_back(size);
-			oldIndicesToNewIndices.emplace(currIndex, size);
+			partVertices.Indices.push_back(size);
+			partVertices.OldIndicesToNewIndices.emplace(currIndex, size);
 
 			uniquePartVerticesIndices.push_back(vertexNum);
-			uniquePartVertices.push_back(group->Vertices[vertexNum]);
+			partVertices.Vertices.Append(group->Vertices[vertexNum]);
 		}
 	}
-	FbxMesh* mesh = MakeMesh(uniquePartVertices, indicesToUniqueVertices, std::string(partName + " Mesh Attribute"), node, lMaterial);
-
-	if (part->Shapes.size() > 0) {
-		auto blendShape = FbxBlendShape::Create(scene, std::string(partName + " Blend Shapes").c_str());
-		mesh->AddDeformer(blendShape);
-
-		// Sort shapes by ShapeValueStartIndex descending
-		std::sort(part->Shapes.begin(), part->Shapes.end(), CompareShape);
-		int prevValue = INT_MAX;
-		for (int i = 0; i < part->Shapes.size(); i++) {
-			Shape* s = part->Shapes[i];
-			auto channel = FbxBlendShapeChannel::Create(blendShape, std::string("channel_" + s->ShapeName).c_str());
-
-			std::vector<uint16_t> shapeIndices = std::vector<uint16_t>();
-			std::vector<Vertex> uniqueShapeVertices = std::vector<Vertex>();
+}
 
-			for (int j = 0; j < uniquePartVertices.size(); j++) {
-				uniqueShapeVertices.push_back(uniquePartVertices[j]);
+void MdlToFbxConverter::ResolvePartShapes(Mesh* group, Submesh* part, int indicesOffset, PartVertices& partVertices) {
+	VertexStreams& uniquePartVertices = partVertices.Vertices;
+	int partBegin = part->IndexOffset - indicesOffset;
+	int partEnd = partBegin + part->IndexNum;
+
+	// Sort shapes by ShapeValueStartIndex descending
+	std::sort(part->Shapes.begin(), part->Shapes.end(), CompareShape);
+	int prevValue = INT_MAX;
+	for (int i = 0; i < part->Shapes.size(); i++) {
+		Shape* s = part->Shapes[i];
+		PartShape partShape(s, arena);
+
+		// Part vertex -> (index, replacement vertex). Several indices can share a vertex; the highest index wins.
+		std::pmr::map<uint16_t, std::pair<int, uint32_t>> changedVertices(arena);
+		for (int k = 0; k < s->ShapeValueStructs.size(); k++) {
+			int currIndex = s->ShapeValueStructs[k].Offset;
+			if (currIndex < partBegin || currIndex >= partEnd || currIndex < s->ShapeValuesStartIndex || currIndex >= prevValue) {
+				continue;
 			}
-
-			for (int j = 0; j < part->IndexNum; j++) {
-				int currIndex = part->IndexOffset - indicesOffset + j;
-				int newIndex = oldIndicesToNewIndices.find(currIndex)->second;
-
-				for (int k = 0; k < s->ShapeValueStructs.size(); k++) {
-					if (s->ShapeValueStructs[k].Offset == currIndex && currIndex >= s->ShapeValuesStartIndex && currIndex < prevValue) {
-						Vertex newVertex = group->Vertices[s->ShapeValueStructs[k].Value];
-						uniqueShapeVertices[newIndex] = newVertex;
-					}
-				}
+			uint16_t newIndex = partVertices.OldIndicesToNewIndices.find(currIndex)->second;
+			auto it = changedVertices.find(newIndex);
+			if (it == changedVertices.end()) {
+				changedVertices.emplace(newIndex, std::make_pair(currIndex, (uint32_t)s->ShapeValueStructs[k].Value));
 			}
-			// We don't want later processed shapes to include vertices from already processed shapes
-			prevValue = s->ShapeValuesStartIndex;
-
-			if (uniqueShapeVertices.size() != uniquePartVertices.size()) {
-				fprintf(stderr, "Number of shape vertices (%i) does not match the number of unique part vertices (%i)\n", (int)uniqueShapeVertices.size(), (int)uniquePartVertices.size());
-				fprintf(stderr, "Could not add shape: %s\n", s->ShapeName.c_str());
+			else if (it->second.first <= currIndex) {
+				it->second = std::make_pair(currIndex, (uint32_t)s->ShapeValueStructs[k].Value);
 			}
-			else {
-				FbxShape* shapeMesh = MakeShape(uniqueShapeVertices, s->ShapeName);
-				channel->SetMultiLayer(false);
-				channel->AddTargetShape(shapeMesh);
+		}
+		// We don't want later processed shapes to include vertices from already processed shapes
+		prevValue = s->ShapeValuesStartIndex;
+
+		partShape.Indices.reserve(changedVertices.size());
+		partShape.PositionDeltas.reserve(changedVertices.size() * 3);
+		partShape.NormalDeltas.reserve(changedVertices.size() * 3);
+		for (auto it = changedVertices.begin(); it != changedVertices.end(); it++) {
+			Vertex& newVertex = group->Vertices[it->second.second];
+			const float* basePosition = uniquePartVertices.Position(it->first);
+			const float* baseNormal = uniquePartVertices.Normal(it->first);
+
+			partShape.Indices.push_back(it->first);
+			for (int c = 0; c < 3; c++) {
+				partShape.PositionDeltas.push_back(newVertex.Position[c] - basePosition[c]);
+				partShape.NormalDeltas.push_back(newVertex.Normal[c] - baseNormal[c]);
 			}
 		}
+		Instrumentation::AddCount("shape_vertices", partShape.Indices.size());
+		partVertices.Shapes.push_back(std::move(partShape));
 	}
+}
+
+void MdlToFbxConverter::AddShapesToMesh(PartVertices& partVertices, FbxMesh* mesh, const std::pmr::string& partName) {
+	if (partVertices.Shapes.size() == 0) {
+		return;
+	}
+
+	auto blendShape = FbxBlendShape::Create(scene, arena->Concat({ partName, " Blend Shapes" }).c_str());
+	mesh->AddDeformer(blendShape);
+
+	for (int i = 0; i < partVertices.Shapes.size(); i++) {
+		PartShape& partShape = partVertices.Shapes[i];
+		auto channel = FbxBlendShapeChannel::Create(blendShape, arena->Concat({ "channel_", partShape.Source->ShapeName }).c_str());
 
-	FbxSkin* skin = FbxSkin::Create(scene, std::string(partName + "Skin Attribute").c_str());
-	auto typeName = skin->GetTypeName();
-	auto defType = skin->GetDeformerType();
+		FbxShape* shapeMesh = MakeShape(partShape, partVertices.Vertices, partShape.Source->ShapeName.c_str());
+		channel->SetMultiLayer(false);
+		channel->AddTargetShape(shapeMesh);
+		Instrumentation::AddCount("shapes", 1);
+	}
+}
+
+void MdlToFbxConverter::AddSkinToMesh(Mesh* group, PartVertices& partVertices, FbxMesh* mesh, FbxNode* node, const std::pmr::string& partName) {
+	VertexStreams& uniquePartVertices = partVertices.Vertices;
+
+	FbxSkin* skin = FbxSkin::Create(scene, arena->Concat({ partName, "Skin Attribute" }).c_str());
 	skin->SetSkinningType(FbxSkin::eLinear);
 	mesh->AddDeformer(skin);
 
-	// Set weights
-	std::map<int, std::string>::iterator it2;
-	int boneNameIndex = 0;
-
-	for (it2 = group->Parent->StringOffsetToStringMap.begin(); it2 != group->Parent->StringOffsetToStringMap.end(); it2++) {
-		std::string boneName = it2->second;
-		Bone* b = n_root->GetBone(boneName);
+	// The part's transform is the same for every cluster, and the bones' were worked out with the skeleton
+	FbxAMatrix partTransform = node->EvaluateGlobalTransform();
 
-		if (b == NULL) {
-			fprintf(stdout, "Continuing on: %s\n", boneName.c_str());
-			continue;
-		}
-		FbxCluster* cluster = FbxCluster::Create(scene, std::string(partName + " " + boneName + " Cluster").c_str());
+	// Set weights
+	for (int boneNameIndex = 0; boneNameIndex < ModelBones.size(); boneNameIndex++) {
+		Bone* b = ModelBones[boneNameIndex];
+		FbxCluster* cluster = FbxCluster::Create(scene, arena->Concat({ partName, " ", b->Name, " Cluster" }).c_str());
 
 		cluster->SetLink(BoneToNode[b]);
 		cluster->SetLinkMode(FbxCluster::ELinkMode::eNormalize);
 
-		cluster->SetTransformMatrix(node->EvaluateGlobalTransform());
-		cluster->SetTransformLinkMatrix(BoneToNode[b]->EvaluateGlobalTransform());
+		cluster->SetTransformMatrix(partTransform);
+		cluster->SetTransformLinkMatrix(ToFbxMatrix(b->WorldMatrix));
 
 		for (int vi = 0; vi < uniquePartVertices.size(); vi++) {
-			Vertex v = uniquePartVertices[vi];
-
 			for (int wi = 0; wi < 4; wi++) {
-				unsigned char set = group->BoneTable[v.BlendIndices[wi]];
+				unsigned char set = group->BoneTable[uniquePartVertices.BlendIndex(vi, wi)];
+				float weight = uniquePartVertices.BlendWeight(vi, wi);
 
-				if (set == boneNameIndex && v.BlendWeights[wi] > 0) {
-					cluster->AddControlPointIndex(vi, v.BlendWeights[wi]);
+				if (set == boneNameIndex && weight > 0) {
+					cluster->AddControlPointIndex(vi, weight);
 				}
 			}
 		}
 		if (cluster->GetControlPointIndicesCount() > 0) {
 			skin->AddCluster(cluster);
+			Instrumentation::AddCount("clusters", 1);
 		}
 		else {
 			cluster->Destroy();
 		}
-
-		boneNameIndex++;
 	}
-	FbxPose* pose = scene->GetPose(0);
-	FbxMatrix bind = node->EvaluateGlobalTransform();
-	pose->Add(node, bind);
 }
 
-FbxMesh* MdlToFbxConverter::MakeMesh(std::vector<Vertex>& vertices, std::vector<unsigned short>& indices, std::string meshName, FbxNode* parent, FbxSurfaceMaterial* material) {
-	FbxMesh* mesh = FbxMesh::Create(manager, meshName.c_str());
+FbxMesh* MdlToFbxConverter::MakeMesh(VertexStreams& vertices, std::pmr::vector<unsigned short>& indices, const char* meshName, FbxNode* parent, FbxSurfaceMaterial* material) {
+	ScopedTimer timer("MakeMesh");
+	Instrumentation::AddCount("vertices", vertices.size());
+	Instrumentation::AddCount("indices", indices.size());
+
+	FbxMesh* mesh = FbxMesh::Create(manager, meshName);
 	parent->SetShadingMode(FbxNode::eTextureShading);
 
 	parent->AddMaterial(material);
@@ -402,27 +805,26 @@ FbxMesh* MdlToFbxConverter::MakeMesh(std::vector<Vertex>& vertices, std::vector<
 	uv2Layer->SetMappingMode(FbxLayerElement::EMappingMode::eByControlPoint);
 	layer2->SetUVs(uv2Layer);
 
-	auto worldTransform = parent->EvaluateGlobalTransform();
-	auto normalMatrix = parent->EvaluateLocalTransform().Inverse().Transpose();
-
+	// The streams only get widened to doubles here, where the FBX SDK wants them
 	for (int i = 0; i < vertices.size(); i++) {
-		Vertex v = vertices[i];
-		FbxVector4 pos = FbxVector4(v.Position[0], v.Position[1], v.Position[2], v.Position[3]);
-		FbxVector4 normal = FbxVector4(v.Normal[0], v.Normal[1], v.Normal[2]);
+		const float* p = vertices.Position(i);
+		const float* n = vertices.Normal(i);
+		FbxVector4 pos = FbxVector4(p[0], p[1], p[2], 1.0);
+		FbxVector4 normal = FbxVector4(n[0], n[1], n[2]);
 
 		mesh->SetControlPointAt(pos, normal, i);
 
 		// ffxiv uvs are in [1, -1] and inverted vertically
-		uvElement->GetDirectArray().Add(FbxVector2(v.UV[0], 1 - v.UV[1]));
-		uv2Layer->GetDirectArray().Add(FbxVector2(v.UV[2], 1 - v.UV[3]));
+		uvElement->GetDirectArray().Add(FbxVector2(vertices.UV(i, 0), 1 - vertices.UV(i, 1)));
+		uv2Layer->GetDirectArray().Add(FbxVector2(vertices.UV(i, 2), 1 - vertices.UV(i, 3)));
 	}
 
 	for (int i = 0; i < indices.size(); i += 3) {
 		mesh->BeginPolygon();
 		for (int j = 0; j < 3; j++) {
-			mesh->AddPolygon(indices[i + j]);
-			Vertex vert = vertices[indices[i + j]];
-			colorElement->GetDirectArray().Add(FbxColor(vert.Color[0], vert.Color[1], vert.Color[2], vert.Color[3]));
+			unsigned short index = indices[i + j];
+			mesh->AddPolygon(index);
+			colorElement->GetDirectArray().Add(FbxColor(vertices.Color(index, 0), vertices.Color(index, 1), vertices.Color(index, 2), vertices.Color(index, 3)));
 			colorElement->GetIndexArray().Add(i + j);
 		}
 		mesh->EndPolygon();
@@ -432,25 +834,37 @@ FbxMesh* MdlToFbxConverter::MakeMesh(std::vector<Vertex>& vertices, std::vector<
 }
 
 
-FbxShape* MdlToFbxConverter::MakeShape(std::vector<Vertex>& vertices, std::string meshName) {
-	FbxShape* shapeMesh = FbxShape::Create(manager, meshName.c_str());
+// FbxShape needs every control point, so this is the only place a shape is made dense
+FbxShape* MdlToFbxConverter::MakeShape(PartShape& partShape, VertexStreams& baseVertices, const char* meshName) {
+	FbxShape* shapeMesh = FbxShape::Create(manager, meshName);
+	int count = baseVertices.size();
 
-	shapeMesh->InitControlPoints(vertices.size());
-	shapeMesh->InitNormals(vertices.size());
-	FbxVector4* controlPoints = shapeMesh->GetControlPoints();
+	shapeMesh->InitControlPoints(count);
+	shapeMesh->InitNormals(count);
 
-	for (int i = 0; i < vertices.size(); i++) {
-		Vertex v = vertices[i];
-		FbxVector4 pos = FbxVector4(v.Position[0], v.Position[1], v.Position[2], v.Position[3]);
-		FbxVector4 normal = FbxVector4(v.Normal[0], v.Normal[1], v.Normal[2]);
+	for (int i = 0; i < count; i++) {
+		const float* p = baseVertices.Position(i);
+		const float* n = baseVertices.Normal(i);
+		shapeMesh->SetControlPointAt(FbxVector4(p[0], p[1], p[2], 1.0), FbxVector4(n[0], n[1], n[2]), i);
+	}
 
-		shapeMesh->SetControlPointAt(pos, normal, i);
+	for (int i = 0; i < partShape.Indices.size(); i++) {
+		int vi = partShape.Indices[i];
+		const float* p = baseVertices.Position(vi);
+		const float* n = baseVertices.Normal(vi);
+		const float* dp = &partShape.PositionDeltas[i * 3];
+		const float* dn = &partShape.NormalDeltas[i * 3];
+		FbxVector4 pos = FbxVector4(p[0] + dp[0], p[1] + dp[1], p[2] + dp[2], 1.0);
+		FbxVector4 normal = FbxVector4(n[0] + dn[0], n[1] + dn[1], n[2] + dn[2]);
+
+		shapeMesh->SetControlPointAt(pos, normal, vi);
 	}
 
 	return shapeMesh;
 }
 
-int MdlToFbxConverter::ExportScene() {
+int MdlToFbxConverter::ExportScene(std::string path) {
+	ScopedTimer timer("ExportScene");
 	auto ios = manager->GetIOSettings();
 	ios->SetBoolProp(EXP_FBX_MATERIAL, true);
 	ios->SetBoolProp(EXP_FBX_TEXTURE, true);
@@ -461,16 +875,49 @@ int MdlToFbxConverter::ExportScene() {
 	ios->SetBoolProp(EXP_FBX_GLOBAL_SETTINGS, true);
 
 	FbxExporter* exporter = FbxExporter::Create(manager, "");
-
-	char* lFileName = const_cast<char*>(outputPath.c_str());
 	manager->SetIOSettings(ios);
+
+	if (options.OutputSink) {
+		// Exported into memory; whoever owns the sink decides when the file hits the disk
+		std::vector<char> data;
+		FbxMemoryStream stream(manager, data);
+		if (!exporter->Initialize(&stream, NULL, stream.GetWriterID(), ios)) {
+			Instrumentation::Log(LogLevel::Error, "Call to FbxExporter::Initialize failed");
+			exporter->Destroy();
+			return -1;
+		}
+		bool exported = exporter->Export(scene);
+		exporter->Destroy();
+		if (!exported) {
+			Instrumentation::Log(LogLevel::Error, "Could not export %s", path.c_str());
+			return -1;
+		}
+
+		Instrumentation::AddCount("bytes_written", (long long)data.size());
+		options.OutputSink(path, std::move(data));
+		writtenFiles.push_back(path);
+		return 0;
+	}
+
+	char* lFileName = const_cast<char*>(path.c_str());
 	bool exportStatus = exporter->Initialize(lFileName, -1, ios);
 	if (!exportStatus) {
-		std::cout << "Call to FbxExporter::Initialize failed" << std::endl;
+		Instrumentation::Log(LogLevel::Error, "Call to FbxExporter::Initialize failed");
+		exporter->Destroy();
+		return -1;
+	}
+	if (!exporter->Export(scene)) {
+		Instrumentation::Log(LogLevel::Error, "Could not export %s", path.c_str());
+		exporter->Destroy();
 		return -1;
 	}
-	exporter->Export(scene);
 	exporter->Destroy();
 
+	std::ifstream exported(path, std::ios::binary | std::ios::ate);
+	if (exported.is_open()) {
+		Instrumentation::AddCount("bytes_written", (long long)exported.tellg());
+	}
+	writtenFiles.push_back(path);
+
 	return 0;
 }
\ No newline at end of file
@@ -1,14 +1,94 @@
 #pragma once
 
 #include <string>
+#include <functional>
 #include "LuminaPlusPlus/Models/Models/Model.h"
 #include "fbxsdk.h"
 #include "Skeleton.h"
+#include "ScratchArena.h"
+#include "VertexStreams.h"
+
+enum class LodExportMode {
+	// Only the default (highest detail) lod is written
+	DefaultLod,
+	// Every lod is written into a single file under an FbxLODGroup
+	LodGroup,
+	// Every lod is written to its own file, "output_lod0.fbx", "output_lod1.fbx", ...
+	SeparateFiles
+};
+
+enum class ExportFormat {
+	Fbx,
+	// Binary glTF, written directly without the FBX SDK. Lods can only be written as separate files.
+	Glb
+};
+
+// Selects which meshes and parts are exported. An empty list or a mask of 0 does not filter anything.
+struct PartFilter {
+	std::vector<int> MeshIndices;
+	std::vector<int> PartIndices;
+	std::vector<std::string> MaterialPaths;
+	// A part is exported if its attribute mask shares any bit with this one
+	uint32_t AttributeMask = 0;
+
+	bool IncludesMesh(Mesh* group) const;
+	bool IncludesPart(Mesh* group, Submesh* part, int partNumber) const;
+};
+
+struct ExportOptions {
+	ExportFormat Format = ExportFormat::Fbx;
+	LodExportMode LodMode = LodExportMode::DefaultLod;
+	PartFilter Filter;
+	// The body skeleton of the mdl's race, e.g. c1401b0001.skel, is used instead if it is in the same directory
+	std::string SkeletonPath = "..\\Skeletons\\c0101b0001.skel";
+	// Face, hair and tail skeletons merged into the body one. If empty, they are found next to SkeletonPath from the mdl's path.
+	std::vector<std::string> SupplementarySkeletonPaths;
+	// Scratch memory for the conversion; batch callers pass one per worker so it is reused between jobs.
+	// If NULL, the converter makes its own.
+	ScratchArena* Arena = NULL;
+	// Keep uvs as half floats and colours and weights as unorm8 while a part is being prepared
+	bool PackVertexStreams = true;
+	// If set, the conversion uses this manager rather than starting the FBX SDK up and shutting it down again.
+	// A manager can only be used by one conversion at a time.
+	FbxManager* Manager = NULL;
+	// If set, finished files are handed to this instead of being written to disk, e.g. for a background writer
+	std::function<void(const std::string& path, std::vector<char>&& data)> OutputSink;
+};
+
+// The part vertices a shape moves, in ascending order, with a float3 position and normal delta for each.
+// Shapes usually only touch a small part of a mesh, so only the changed vertices are kept.
+struct PartShape {
+	Shape* Source;
+	std::pmr::vector<uint16_t> Indices;
+	std::pmr::vector<float> PositionDeltas;
+	std::pmr::vector<float> NormalDeltas;
+
+	PartShape(Shape* source, std::pmr::memory_resource* resource) : Source(source), Indices(resource), PositionDeltas(resource), NormalDeltas(resource) {}
+};
+
+// The vertices of a single part, with the part's indices remapped to them.
+// This is everything an exporter needs for a part, whatever format it writes.
+struct PartVertices {
+	VertexStreams Vertices;
+	std::pmr::vector<uint16_t> Indices;
+	// Position in the mesh's index buffer -> part vertex
+	std::pmr::map<uint32_t, uint16_t> OldIndicesToNewIndices;
+	std::pmr::vector<PartShape> Shapes;
+
+	PartVertices(std::pmr::memory_resource* resource, bool packed = false) : Vertices(resource, packed), Indices(resource), OldIndicesToNewIndices(resource), Shapes(resource) {}
+};
+
+// "output.fbx" -> "output_lod1.fbx"
+std::string GetLodOutputPath(std::string path, int lod);
+
+class GlbWriter;
 
 class MdlToFbxConverter
 {
+	friend class ConversionBenchmark;
+
 public:
-	__declspec(dllexport) MdlToFbxConverter(const char* filePath, const char* outputPath = "output.fbx");
+	__declspec(dllexport) MdlToFbxConverter(const char* filePath, const char* outputPath = "output.fbx", ExportOptions options = ExportOptions());
 	__declspec(dllexport) ~MdlToFbxConverter();
 
 	void SetModel(Model* mdl);
@@ -18,24 +98,60 @@ public:
 	void SetSkeletonFromFile(std::string filePath);
 	void SetSkeletonFromData(const char* data);
 
+	// 0 if every file was written, -1 otherwise
+	int GetExportStatus();
+	// Every file the conversion wrote, or handed to the OutputSink, in lod order
+	std::vector<std::string> GetWrittenFiles();
+
 private:
+	MdlToFbxConverter();
+
 	Model* model;
 	MdlFile* mdlFile;
 	FbxManager* manager;
 	FbxScene* scene;
+	FbxNode* rootNode;
+	FbxPose* bindPose;
 	std::map<std::string, FbxSurfaceMaterial*> MaterialPathToSurfaceMaterial;
 	std::map<Bone*, FbxNode*> BoneToNode;
-	Bone* n_root;
+	std::map<std::string, Bone*> BoneNameToBone;
+	// Skeleton bones in the order of the model's bone names; the index is what BoneTable refers to
+	std::vector<Bone*> ModelBones;
+	Bone* n_root = NULL;
+	// Keeps a skeleton from BuildMergedSkeleton alive for the conversion, even if the cache drops it
+	std::shared_ptr<Bone> sharedSkeleton;
 	std::string outputPath;
+	std::string mdlPath;
+	std::string modelName = "model name";
+	ExportOptions options;
+	int exportStatus = 0;
+	std::vector<std::string> writtenFiles;
+	ScratchArena* arena;
+	std::unique_ptr<ScratchArena> ownedArena;
 
+	void LoadSkeleton();
 	void InitScene();
 	void CreateScene(Model* model);
-	int ExportScene();
+	int ExportScene(std::string path);
+	void ExportLods();
+	void AddModelToScene(Model* model, FbxNode* parent);
+	std::vector<int> GetSelectedParts(Mesh* group);
+	void ExportGlb();
+	void AddModelToGlb(Model* model, GlbWriter& writer);
+	void RemoveNodeFromScene(FbxNode* node);
 	void AddPartToScene(Mesh* group, Submesh* part, FbxNode* parent, int indicesOffset, int partNumber);
-	FbxMesh* MakeMesh(std::vector<Vertex>& vertices, std::vector<unsigned short>& indices, std::string meshName, FbxNode* parent, FbxSurfaceMaterial* material);
+	FbxSurfaceMaterial* GetSurfaceMaterial(Mesh* group);
+	void GetUniquePartVertices(Mesh* group, Submesh* part, int indicesOffset, PartVertices& partVertices);
+	void ResolvePartShapes(Mesh* group, Submesh* part, int indicesOffset, PartVertices& partVertices);
+	void AddShapesToMesh(PartVertices& partVertices, FbxMesh* mesh, const std::pmr::string& partName);
+	void AddSkinToMesh(Mesh* group, PartVertices& partVertices, FbxMesh* mesh, FbxNode* node, const std::pmr::string& partName);
+	FbxMesh* MakeMesh(VertexStreams& vertices, std::pmr::vector<unsigned short>& indices, const char* meshName, FbxNode* parent, FbxSurfaceMaterial* material);
 	void AddBoneToScene(Bone*, FbxPose* bindPose, FbxNode* parentNode);
 	void CreateMaterials();
-	FbxShape* MakeShape(std::vector<Vertex>& vertices, std::string meshName);
+	void BuildBoneLookup(Bone* bone);
+	void BuildModelBones(Model* model);
+	void SetArena(ScratchArena* externalArena);
+	FbxShape* MakeShape(PartShape& partShape, VertexStreams& baseVertices, const char* meshName);
 
 	void AddShapeToScene(std::vector<Vertex>& vertices, std::vector<Shape> shapes, FbxNode* parent);
 };
@@ -0,0 +1,157 @@
+#include "MemoryBudgetScheduler.h"
+#include "MemoryTracker.h"
+#include "MdlCatalogue.h"
+#include "Instrumentation.h"
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+// MemoryTracker doesn't see the FBX SDK's allocations, and its scene holds about as much again as the model
+static const double FbxSdkHeadroom = 2.0;
+
+MemoryBudgetScheduler::MemoryBudgetScheduler(ExportOptions options, unsigned long long budgetBytes, int threadCount) {
+	this->options = options;
+	this->budgetBytes = budgetBytes;
+	this->threadCount = threadCount > 0 ? threadCount : std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+unsigned long long MemoryBudgetScheduler::GetDecodedBytes(std::string mdlPath, const ExportOptions& options) {
+	MdlFileHeader header;
+	std::ifstream ifs(mdlPath, std::ios::binary);
+	if (!ifs.read((char*)&header, sizeof(header))) {
+		// Not an mdl we can read the header of; the converter will fail on it, so it only needs a token amount
+		std::error_code ec;
+		unsigned long long size = std::filesystem::file_size(mdlPath, ec);
+		return ec ? 0 : size;
+	}
+
+	int lods = options.LodMode == LodExportMode::DefaultLod ? 1 : std::min((int)header.LodCount, 3);
+	unsigned long long bytes = header.StackSize + header.RuntimeSize;
+	for (int lod = 0; lod < std::max(lods, 1); lod++) {
+		bytes += header.VertexBufferSize[lod] + header.IndexBufferSize[lod];
+	}
+	return bytes;
+}
+
+ScheduleResult MemoryBudgetScheduler::Run(const std::vector<BatchJob>& jobs) {
+	ScheduleResult result;
+	result.Jobs.resize(jobs.size());
+
+	std::vector<unsigned long long> decodedBytes(jobs.size());
+	for (int i = 0; i < jobs.size(); i++) {
+		decodedBytes[i] = GetDecodedBytes(jobs[i].MdlPath, options);
+		result.Jobs[i].MdlPath = jobs[i].MdlPath;
+	}
+
+	// Biggest first, so the large jobs are spread over the run and the small ones fill the gaps at the end
+	std::vector<int> pending(jobs.size());
+	for (int i = 0; i < jobs.size(); i++) {
+		pending[i] = i;
+	}
+	std::stable_sort(pending.begin(), pending.end(), [&](int a, int b) { return decodedBytes[a] > decodedBytes[b]; });
+
+	auto start = std::chrono::steady_clock::now();
+	auto lastChange = start;
+	double concurrencySeconds = 0;
+	// Call with the mutex held, before running changes
+	auto accumulateConcurrency = [&]() {
+		auto now = std::chrono::steady_clock::now();
+		concurrencySeconds += running * std::chrono::duration<double>(now - lastChange).count();
+		lastChange = now;
+	};
+
+	double headroom = options.Format == ExportFormat::Fbx ? FbxSdkHeadroom : 1.0;
+	auto work = [&]() {
+		ScratchArena arena;
+		ExportOptions jobOptions = options;
+		jobOptions.Arena = &arena;
+
+		while (true) {
+			int job = -1;
+			unsigned long long estimate = 0;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (pending.size() > 0) {
+					// A job bigger than the whole budget still runs, just on its own
+					for (int p = 0; p < pending.size(); p++) {
+						estimate = (unsigned long long)(decodedBytes[pending[p]] * bytesPerDecodedByte * headroom);
+						if (running == 0 || bytesInFlight + estimate <= budgetBytes) {
+							job = pending[p];
+							pending.erase(pending.begin() + p);
+							break;
+						}
+					}
+					if (job != -1) {
+						break;
+					}
+					jobFinished.wait(lock);
+				}
+				if (job == -1) {
+					return;
+				}
+				accumulateConcurrency();
+				running++;
+				bytesInFlight += estimate;
+				result.MaxConcurrency = std::max(result.MaxConcurrency, running);
+			}
+
+			auto jobStart = std::chrono::steady_clock::now();
+			MemoryTracker::BeginJob();
+			int status;
+			{
+				MdlToFbxConverter converter(jobs[job].MdlPath.c_str(), jobs[job].OutputPath.c_str(), jobOptions);
+				status = converter.GetExportStatus();
+			}
+			// The arena's own buffer was allocated before the job started, but the job had all of it
+			unsigned long long peak = MemoryTracker::EndJob() + arena.GetCapacity();
+
+			ScheduledJobResult& jobResult = result.Jobs[job];
+			jobResult.Status = status;
+			jobResult.EstimatedBytes = estimate;
+			jobResult.PeakBytes = peak;
+			jobResult.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - jobStart).count();
+			Instrumentation::Log(LogLevel::Debug, "%s: estimated %llu KB, peak %llu KB", jobs[job].MdlPath.c_str(), estimate / 1024, peak / 1024);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				accumulateConcurrency();
+				running--;
+				bytesInFlight -= estimate;
+				if (status == 0) {
+					result.Converted++;
+				}
+				else {
+					result.Failed++;
+				}
+				if (decodedBytes[job] > 0) {
+					bytesPerDecodedByte = std::max(bytesPerDecodedByte, (double)peak / decodedBytes[job]);
+				}
+			}
+			jobFinished.notify_all();
+		}
+	};
+
+	int workers = std::min(threadCount, (int)jobs.size());
+	std::vector<std::thread> threads;
+	for (int t = 1; t < workers; t++) {
+		threads.emplace_back(work);
+	}
+	work();
+	for (int t = 0; t < threads.size(); t++) {
+		threads[t].join();
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (elapsed > 0) {
+		result.AverageConcurrency = concurrencySeconds / elapsed;
+	}
+	result.PeakProcessBytes = MemoryTracker::GetProcessPeakBytes();
+
+	Instrumentation::Log(LogLevel::Info, "Batch finished: %i converted, %i failed", result.Converted, result.Failed);
+	Instrumentation::Log(LogLevel::Info, "Peak working set %llu MB, %.2f jobs running on average, %i at most, budget %llu MB",
+		result.PeakProcessBytes / (1024 * 1024), result.AverageConcurrency, result.MaxConcurrency, budgetBytes / (1024 * 1024));
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "BatchConverter.h"
+
+struct ScheduledJobResult {
+	std::string MdlPath;
+	int Status = 0;
+	unsigned long long EstimatedBytes = 0;
+	unsigned long long PeakBytes = 0;
+	double Milliseconds = 0;
+};
+
+struct ScheduleResult {
+	int Converted = 0;
+	int Failed = 0;
+	unsigned long long PeakProcessBytes = 0;
+	// Jobs running at once, averaged over the run, and the most there ever were
+	double AverageConcurrency = 0;
+	int MaxConcurrency = 0;
+	std::vector<ScheduledJobResult> Jobs;
+};
+
+// Runs conversions in parallel, starting a job only once the estimated memory of everything running leaves
+// room for it. Small models then fill every core while big bodies don't all land at once. Estimates come from
+// the mdl header's buffer sizes and are scaled by what finished jobs actually used. Only operator new heap is
+// measured (see MemoryTracker), so fbx jobs are given headroom for the FBX SDK's scene on top.
+class MemoryBudgetScheduler
+{
+public:
+	// 0 threads uses one per core
+	MemoryBudgetScheduler(ExportOptions options, unsigned long long budgetBytes, int threadCount = 0);
+
+	ScheduleResult Run(const std::vector<BatchJob>& jobs);
+
+	// Bytes of the mdl that get decoded for the exported lods, read from its header without loading it
+	static unsigned long long GetDecodedBytes(std::string mdlPath, const ExportOptions& options);
+
+private:
+	ExportOptions options;
+	unsigned long long budgetBytes;
+	int threadCount;
+
+	std::mutex mutex;
+	std::condition_variable jobFinished;
+	unsigned long long bytesInFlight = 0;
+	int running = 0;
+	// Peak job memory per decoded mdl byte; only ever raised, so estimates stay on the safe side
+	double bytesPerDecodedByte = 8.0;
+};
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "MemoryTracker.h"
+#include <new>
+#include <cstdlib>
+#include <malloc.h>
+#include <windows.h>
+#include <psapi.h>
+
+// Plain thread locals, so touching them from operator new never allocates
+static thread_local bool tracking = false;
+static thread_local long long currentBytes = 0;
+static thread_local long long peakBytes = 0;
+
+static void Allocated(void* p) {
+	if (tracking && p != NULL) {
+		currentBytes += _msize(p);
+		if (currentBytes > peakBytes) {
+			peakBytes = currentBytes;
+		}
+	}
+}
+
+static void AllocatedAligned(void* p, std::align_val_t alignment) {
+	if (tracking && p != NULL) {
+		currentBytes += _aligned_msize(p, (size_t)alignment, 0);
+		if (currentBytes > peakBytes) {
+			peakBytes = currentBytes;
+		}
+	}
+}
+
+// Memory from before the job can be freed during it, so the count is allowed to go below where it started
+static void Freeing(void* p) {
+	if (tracking && p != NULL) {
+		currentBytes -= _msize(p);
+	}
+}
+
+static void FreeingAligned(void* p, std::align_val_t alignment) {
+	if (tracking && p != NULL) {
+		currentBytes -= _aligned_msize(p, (size_t)alignment, 0);
+	}
+}
+
+void MemoryTracker::BeginJob() {
+	currentBytes = 0;
+	peakBytes = 0;
+	tracking = true;
+}
+
+size_t MemoryTracker::EndJob() {
+	tracking = false;
+	return (size_t)peakBytes;
+}
+
+size_t MemoryTracker::GetProcessPeakBytes() {
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+}
+
+void* operator new(size_t size) {
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	Allocated(p);
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	void* p = malloc(size > 0 ? size : 1);
+	Allocated(p);
+	return p;
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept {
+	Freeing(p);
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	operator delete(p);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	void* p = _aligned_malloc(size > 0 ? size : 1, (size_t)alignment);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	AllocatedAligned(p, alignment);
+	return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	void* p = _aligned_malloc(size > 0 ? size : 1, (size_t)alignment);
+	AllocatedAligned(p, alignment);
+	return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t& tag) noexcept {
+	return operator new(size, alignment, tag);
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+	FreeingAligned(p, alignment);
+	_aligned_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+	operator delete(p, alignment);
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+	operator delete(p, alignment);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+	operator delete(p, alignment);
+}
+
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	operator delete(p, alignment);
+}
+
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	operator delete(p, alignment);
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts what a thread allocates through operator new between BeginJob and EndJob, which covers the model,
+// the scratch arena's spill and anything else the converter builds. Only operator new heap is counted:
+// - The FBX SDK allocates through its own handlers, so its scene memory only shows up in the process peak.
+// - A free is taken off the count of the thread that frees it, so memory allocated on one thread and freed on
+//   another, e.g. a shared skeleton dropped from its cache, leaves one job's count too high and the other's too low.
+static class MemoryTracker
+{
+public:
+	static void BeginJob();
+	// Highest number of bytes the job had allocated at once
+	static size_t EndJob();
+
+	// Peak working set of the whole process so far
+	static size_t GetProcessPeakBytes();
+};
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <cstring>
+
+// Symmetric 4x4 error matrix: a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+struct Quadric {
+	double m[10] = { 0 };
+
+	void AddPlane(double a, double b, double c, double d, double weight) {
+		m[0] += weight * a * a; m[1] += weight * a * b; m[2] += weight * a * c; m[3] += weight * a * d;
+		m[4] += weight * b * b; m[5] += weight * b * c; m[6] += weight * b * d;
+		m[7] += weight * c * c; m[8] += weight * c * d;
+		m[9] += weight * d * d;
+	}
+
+	void Add(const Quadric& other) {
+		for (int i = 0; i < 10; i++) {
+			m[i] += other.m[i];
+		}
+	}
+
+	double Evaluate(const float* p) const {
+		double x = p[0], y = p[1], z = p[2];
+		return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+			+ m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+			+ m[7] * z * z + 2 * m[8] * z
+			+ m[9];
+	}
+};
+
+struct Collapse {
+	int From;
+	int To;
+	double Cost;
+};
+
+static int StrongestBone(const Vertex& v) {
+	int strongest = 0;
+	for (int w = 1; w < 4; w++) {
+		if (v.BlendWeights[w] > v.BlendWeights[strongest]) strongest = w;
+	}
+	return v.BlendIndices[strongest];
+}
+
+static void TriangleNormal(const float* a, const float* b, const float* c, double* normal) {
+	double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	double e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static uint64_t EdgeKey(int a, int b) {
+	return a < b ? ((uint64_t)a << 32) | (uint32_t)b : ((uint64_t)b << 32) | (uint32_t)a;
+}
+
+size_t MeshSimplifier::Simplify(const Vertex* vertices, int vertexCount, const int* indices, size_t indexCount, float targetRatio,
+	const std::vector<int>& lockedVertices, std::vector<int>& simplifiedIndices) {
+	simplifiedIndices.assign(indices, indices + indexCount);
+	size_t targetTriangles = (size_t)(indexCount / 3 * targetRatio);
+	if (vertexCount == 0 || indexCount / 3 <= targetTriangles) {
+		return simplifiedIndices.size() / 3;
+	}
+
+	std::vector<char> locked(vertexCount, 0);
+	for (int i = 0; i < lockedVertices.size(); i++) {
+		locked[lockedVertices[i]] = 1;
+	}
+
+	// Vertices that share a position with another vertex sit on a uv or normal seam; collapsing one side
+	// without the other would tear the mesh open
+	struct PositionKey {
+		float p[3];
+		bool operator==(const PositionKey& other) const { return p[0] == other.p[0] && p[1] == other.p[1] && p[2] == other.p[2]; }
+	};
+	struct PositionHash {
+		size_t operator()(const PositionKey& k) const {
+			uint32_t bits[3];
+			memcpy(bits, k.p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+	std::unordered_map<PositionKey, int, PositionHash> firstAtPosition;
+	firstAtPosition.reserve(vertexCount);
+	for (int v = 0; v < vertexCount; v++) {
+		PositionKey key = { { vertices[v].Position[0], vertices[v].Position[1], vertices[v].Position[2] } };
+		auto it = firstAtPosition.find(key);
+		if (it == firstAtPosition.end()) {
+			firstAtPosition.emplace(key, v);
+		}
+		else {
+			locked[v] = 1;
+			locked[it->second] = 1;
+		}
+	}
+
+	// Edges only one triangle uses are on an open border, e.g. where a glove meets the arm
+	std::unordered_map<uint64_t, int> edgeUses;
+	edgeUses.reserve(indexCount);
+	for (size_t i = 0; i < indexCount; i += 3) {
+		for (int e = 0; e < 3; e++) {
+			edgeUses[EdgeKey(indices[i + e], indices[i + (e + 1) % 3])]++;
+		}
+	}
+	for (auto it = edgeUses.begin(); it != edgeUses.end(); it++) {
+		if (it->second == 1) {
+			locked[(int)(it->first >> 32)] = 1;
+			locked[(int)(it->first & 0xFFFFFFFF)] = 1;
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < indexCount; i += 3) {
+		const float* a = vertices[indices[i]].Position;
+		const float* b = vertices[indices[i + 1]].Position;
+		const float* c = vertices[indices[i + 2]].Position;
+		double n[3];
+		TriangleNormal(a, b, c, n);
+		double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0) continue;
+		// The cross product's length is twice the area, which is the weight
+		double area = length * 0.5;
+		n[0] /= length; n[1] /= length; n[2] /= length;
+		double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+		for (int c2 = 0; c2 < 3; c2++) {
+			quadrics[indices[i + c2]].AddPlane(n[0], n[1], n[2], d, area);
+		}
+	}
+
+	std::vector<int> bones(vertexCount);
+	for (int v = 0; v < vertexCount; v++) {
+		bones[v] = StrongestBone(vertices[v]);
+	}
+
+	std::vector<int> remap(vertexCount);
+	std::vector<int> adjacencyOffsets(vertexCount + 1);
+	std::vector<int> adjacency;
+	std::vector<uint64_t> edges;
+	std::vector<Collapse> collapses;
+	std::vector<char> touched(vertexCount);
+
+	// Each pass makes as many independent collapses as it can, cheapest first, then rebuilds the triangles
+	while (simplifiedIndices.size() / 3 > targetTriangles) {
+		size_t triangleCount = simplifiedIndices.size() / 3;
+
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (size_t i = 0; i < simplifiedIndices.size(); i++) {
+			adjacencyOffsets[simplifiedIndices[i] + 1]++;
+		}
+		for (int v = 0; v < vertexCount; v++) {
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		}
+		adjacency.resize(simplifiedIndices.size());
+		std::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < simplifiedIndices.size(); i++) {
+			adjacency[fill[simplifiedIndices[i]]++] = i / 3;
+		}
+
+		edges.clear();
+		for (size_t i = 0; i < simplifiedIndices.size(); i += 3) {
+			for (int e = 0; e < 3; e++) {
+				edges.push_back(EdgeKey(simplifiedIndices[i + e], simplifiedIndices[i + (e + 1) % 3]));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		collapses.clear();
+		for (int i = 0; i < edges.size(); i++) {
+			int a = (int)(edges[i] >> 32);
+			int b = (int)(edges[i] & 0xFFFFFFFF);
+			if (bones[a] != bones[b]) continue;
+
+			Quadric combined = quadrics[a];
+			combined.Add(quadrics[b]);
+			if (!locked[a]) {
+				collapses.push_back({ a, b, combined.Evaluate(vertices[b].Position) });
+			}
+			if (!locked[b]) {
+				double cost = combined.Evaluate(vertices[a].Position);
+				if (locked[a] || cost < collapses.back().Cost) {
+					if (!locked[a]) collapses.pop_back();
+					collapses.push_back({ b, a, cost });
+				}
+			}
+		}
+		if (collapses.size() == 0) {
+			break;
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& l, const Collapse& r) { return l.Cost < r.Cost; });
+
+		for (int v = 0; v < vertexCount; v++) {
+			remap[v] = v;
+		}
+		std::fill(touched.begin(), touched.end(), 0);
+		// Every collapse removes about two triangles
+		size_t wanted = (triangleCount - targetTriangles + 1) / 2 + 1;
+		size_t made = 0;
+
+		for (int c = 0; c < collapses.size() && made < wanted; c++) {
+			int from = collapses[c].From;
+			int to = collapses[c].To;
+			if (touched[from] || touched[to]) continue;
+
+			// Reject the collapse if it would flip any triangle that survives it
+			bool flips = false;
+			for (int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1] && !flips; a++) {
+				const int* tri = &simplifiedIndices[adjacency[a] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to) continue;
+
+				double before[3];
+				double after[3];
+				TriangleNormal(vertices[tri[0]].Position, vertices[tri[1]].Position, vertices[tri[2]].Position, before);
+				const float* p[3];
+				for (int k = 0; k < 3; k++) {
+					p[k] = vertices[tri[k] == from ? to : tri[k]].Position;
+				}
+				TriangleNormal(p[0], p[1], p[2], after);
+				if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0) {
+					flips = true;
+				}
+			}
+			if (flips) continue;
+
+			remap[from] = to;
+			quadrics[to].Add(quadrics[from]);
+			made++;
+			// Nothing around the collapse can move again this pass, so the flip checks above stay valid
+			for (int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1]; a++) {
+				const int* tri = &simplifiedIndices[adjacency[a] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+			touched[to] = 1;
+		}
+		if (made == 0) {
+			break;
+		}
+
+		size_t write = 0;
+		for (size_t i = 0; i < simplifiedIndices.size(); i += 3) {
+			int a = remap[simplifiedIndices[i]];
+			int b = remap[simplifiedIndices[i + 1]];
+			int c = remap[simplifiedIndices[i + 2]];
+			if (a == b || b == c || a == c) continue;
+			simplifiedIndices[write++] = a;
+			simplifiedIndices[write++] = b;
+			simplifiedIndices[write++] = c;
+		}
+		simplifiedIndices.resize(write);
+	}
+
+	return simplifiedIndices.size() / 3;
+}
\ No newline at end of file
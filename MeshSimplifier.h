@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include "LuminaPlusPlus/Models/Models/Vertex.h"
+
+// Quadric error edge collapse (Garland, Heckbert 1997) over one part's vertex and index buffers.
+// Vertices are only ever collapsed onto other existing vertices, so uvs, colours and weights never get
+// interpolated, and the result is a new index list into the same vertices.
+static class MeshSimplifier
+{
+public:
+	// lockedVertices are never moved: vertices that shapes change, for one. Uv/normal seams and open borders are
+	// found and locked here, and two vertices are only collapsed together if they share their strongest bone.
+	// Returns the achieved triangle count, which can stay above the target if too much of the mesh is locked.
+	static size_t Simplify(const Vertex* vertices, int vertexCount, const int* indices, size_t indexCount, float targetRatio,
+		const std::vector<int>& lockedVertices, std::vector<int>& simplifiedIndices);
+};
\ No newline at end of file
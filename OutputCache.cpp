@@ -0,0 +1,262 @@
+#include "OutputCache.h"
+#include "Instrumentation.h"
+#include "include/json.hpp"
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+// Bumped whenever converter changes would make previously cached files wrong
+static const uint64_t CacheFormatVersion = 5;
+static const uint64_t FnvPrime = 1099511628211ULL;
+
+static long long Now() {
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+OutputCache::OutputCache(std::string directory, unsigned long long maxBytes) {
+	this->directory = directory;
+	this->maxBytes = maxBytes;
+
+	std::error_code ec;
+	fs::create_directories(directory, ec);
+	LoadManifest();
+}
+
+OutputCache::~OutputCache() {
+	SaveManifest();
+}
+
+// FNV-1a
+uint64_t OutputCache::HashBytes(const char* data, size_t length, uint64_t seed) {
+	uint64_t hash = seed;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= FnvPrime;
+	}
+	return hash;
+}
+
+uint64_t OutputCache::HashFile(std::string filePath, uint64_t seed) {
+	std::ifstream ifs(filePath, std::ios::binary);
+	if (!ifs.is_open()) {
+		// A missing file still has to change the hash, otherwise adding it later would hit a stale entry
+		return HashBytes(filePath.c_str(), filePath.size(), seed ^ 0xFFFFFFFFULL);
+	}
+
+	uint64_t hash = seed;
+	char buffer[1 << 16];
+	while (ifs) {
+		ifs.read(buffer, sizeof(buffer));
+		hash = HashBytes(buffer, (size_t)ifs.gcount(), hash);
+	}
+	return hash;
+}
+
+// Anything in ExportOptions that changes the output has to be hashed here
+uint64_t OutputCache::HashOptions(const ExportOptions& options, uint64_t seed) {
+	uint64_t hash = HashBytes((const char*)&CacheFormatVersion, sizeof(CacheFormatVersion), seed);
+
+	int format = (int)options.Format;
+	hash = HashBytes((const char*)&format, sizeof(format), hash);
+	int lodMode = (int)options.LodMode;
+	hash = HashBytes((const char*)&lodMode, sizeof(lodMode), hash);
+	char packed = options.PackVertexStreams ? 1 : 0;
+	hash = HashBytes(&packed, 1, hash);
+
+	const PartFilter& filter = options.Filter;
+	for (int i = 0; i < filter.MeshIndices.size(); i++) {
+		hash = HashBytes((const char*)&filter.MeshIndices[i], sizeof(int), hash);
+	}
+	hash = HashBytes("|", 1, hash);
+	for (int i = 0; i < filter.PartIndices.size(); i++) {
+		hash = HashBytes((const char*)&filter.PartIndices[i], sizeof(int), hash);
+	}
+	hash = HashBytes("|", 1, hash);
+	for (int i = 0; i < filter.MaterialPaths.size(); i++) {
+		hash = HashBytes(filter.MaterialPaths[i].c_str(), filter.MaterialPaths[i].size() + 1, hash);
+	}
+	hash = HashBytes((const char*)&filter.AttributeMask, sizeof(filter.AttributeMask), hash);
+
+	return hash;
+}
+
+uint64_t OutputCache::HashJob(std::string mdlPath, const ExportOptions& options, const std::vector<char>* mdlData) {
+	uint64_t hash = mdlData != NULL ? HashBytes(mdlData->data(), mdlData->size()) : HashFile(mdlPath);
+	std::string bodyPath = Skeleton::GetBodySkeletonPath(mdlPath, options.SkeletonPath);
+	hash = HashFile(bodyPath, hash);
+
+	std::vector<std::string> supplementaryPaths = options.SupplementarySkeletonPaths;
+	if (supplementaryPaths.size() == 0) {
+		supplementaryPaths = Skeleton::GetSupplementarySkeletonPaths(mdlPath, bodyPath);
+	}
+	for (int i = 0; i < supplementaryPaths.size(); i++) {
+		hash = HashFile(supplementaryPaths[i], hash);
+	}
+	return HashOptions(options, hash);
+}
+
+std::string OutputCache::HashToKey(uint64_t hash) {
+	char key[17];
+	snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+	return std::string(key);
+}
+
+bool OutputCache::Restore(uint64_t hash, std::string outputPath) {
+	std::string key = HashToKey(hash);
+	auto it = Entries.find(key);
+	if (it == Entries.end() || it->second.Files.size() == 0) {
+		return false;
+	}
+
+	std::vector<std::string> outputPaths;
+	if (it->second.SeparateLods) {
+		for (int i = 0; i < it->second.Files.size(); i++) {
+			outputPaths.push_back(GetLodOutputPath(outputPath, i));
+		}
+	}
+	else {
+		outputPaths.push_back(outputPath);
+	}
+
+	std::error_code ec;
+	for (int i = 0; i < outputPaths.size(); i++) {
+		fs::copy_file(fs::path(directory) / it->second.Files[i], outputPaths[i], fs::copy_options::overwrite_existing, ec);
+		if (ec) {
+			// Someone removed the cached file from under us; drop the entry and convert again
+			Instrumentation::Log(LogLevel::Warning, "Cache entry %s is damaged: %s", key.c_str(), ec.message().c_str());
+			RemoveEntry(key);
+			return false;
+		}
+	}
+
+	it->second.LastUsed = Now();
+	manifestChanged = true;
+	Instrumentation::AddCount("cache_hits", 1);
+	return true;
+}
+
+void OutputCache::Store(uint64_t hash, std::string source, const std::vector<std::string>& outputPaths, bool separateLods) {
+	std::string key = HashToKey(hash);
+	RemoveEntry(key);
+
+	CacheEntry entry;
+	entry.Source = source;
+	entry.SeparateLods = separateLods;
+	entry.LastUsed = Now();
+
+	std::error_code ec;
+	for (int i = 0; i < outputPaths.size(); i++) {
+		std::string fileName = key + "_" + std::to_string(i) + fs::path(outputPaths[i]).extension().string();
+		fs::copy_file(outputPaths[i], fs::path(directory) / fileName, fs::copy_options::overwrite_existing, ec);
+		if (ec) {
+			Instrumentation::Log(LogLevel::Warning, "Could not cache %s: %s", outputPaths[i].c_str(), ec.message().c_str());
+			for (int j = 0; j < entry.Files.size(); j++) {
+				fs::remove(fs::path(directory) / entry.Files[j], ec);
+			}
+			return;
+		}
+		entry.Files.push_back(fileName);
+		entry.Bytes += fs::file_size(outputPaths[i], ec);
+	}
+
+	totalBytes += entry.Bytes;
+	Entries.emplace(key, entry);
+	manifestChanged = true;
+	Evict();
+}
+
+void OutputCache::RemoveEntry(std::string key) {
+	auto it = Entries.find(key);
+	if (it == Entries.end()) {
+		return;
+	}
+
+	std::error_code ec;
+	for (int i = 0; i < it->second.Files.size(); i++) {
+		fs::remove(fs::path(directory) / it->second.Files[i], ec);
+	}
+	totalBytes -= it->second.Bytes;
+	Entries.erase(it);
+	manifestChanged = true;
+}
+
+// Least recently used entries go first
+void OutputCache::Evict() {
+	while (totalBytes > maxBytes && Entries.size() > 1) {
+		auto oldest = Entries.begin();
+		for (auto it = Entries.begin(); it != Entries.end(); it++) {
+			if (it->second.LastUsed < oldest->second.LastUsed) {
+				oldest = it;
+			}
+		}
+		Instrumentation::Log(LogLevel::Debug, "Evicting %s from cache", oldest->second.Source.c_str());
+		RemoveEntry(oldest->first);
+	}
+}
+
+void OutputCache::LoadManifest() {
+	std::ifstream ifs(fs::path(directory) / "manifest.json");
+	if (!ifs.is_open()) {
+		return;
+	}
+
+	try {
+		json manifest = json::parse(ifs);
+		if (manifest.value("version", (uint64_t)0) != CacheFormatVersion) {
+			Instrumentation::Log(LogLevel::Info, "Cache in %s is from another version, starting over", directory.c_str());
+			return;
+		}
+		for (auto& item : manifest.at("entries").items()) {
+			CacheEntry entry;
+			entry.Files = item.value().at("files").get<std::vector<std::string>>();
+			entry.Source = item.value().value("source", "");
+			entry.SeparateLods = item.value().value("separate_lods", false);
+			entry.Bytes = item.value().value("bytes", 0ULL);
+			entry.LastUsed = item.value().value("last_used", 0LL);
+			totalBytes += entry.Bytes;
+			Entries.emplace(item.key(), entry);
+		}
+	}
+	catch (json::exception& ex) {
+		Instrumentation::Log(LogLevel::Warning, "Could not read cache manifest: %s", ex.what());
+		Entries.clear();
+		totalBytes = 0;
+	}
+}
+
+void OutputCache::SaveManifest() {
+	if (!manifestChanged) {
+		return;
+	}
+
+	json entries = json::object();
+	for (auto it = Entries.begin(); it != Entries.end(); it++) {
+		entries[it->first] = {
+			{ "files", it->second.Files },
+			{ "source", it->second.Source },
+			{ "separate_lods", it->second.SeparateLods },
+			{ "bytes", it->second.Bytes },
+			{ "last_used", it->second.LastUsed }
+		};
+	}
+	json manifest;
+	manifest["version"] = CacheFormatVersion;
+	manifest["entries"] = entries;
+
+	// Write then rename, so a crash mid-write doesn't lose the whole cache
+	fs::path manifestPath = fs::path(directory) / "manifest.json";
+	fs::path tempPath = fs::path(directory) / "manifest.json.tmp";
+	std::ofstream ofs(tempPath);
+	if (!ofs.is_open()) {
+		Instrumentation::Log(LogLevel::Warning, "Could not write cache manifest to %s", directory.c_str());
+		return;
+	}
+	ofs << manifest.dump(1);
+	ofs.close();
+
+	std::error_code ec;
+	fs::rename(tempPath, manifestPath, ec);
+	manifestChanged = false;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include "MdlToFbxConverter.h"
+
+struct CacheEntry {
+	// File names inside the cache directory, in the same order as the outputs they were stored from
+	std::vector<std::string> Files;
+	// The files are lods that were written with GetLodOutputPath rather than a single output
+	bool SeparateLods = false;
+	std::string Source;
+	unsigned long long Bytes = 0;
+	long long LastUsed = 0;
+};
+
+// On-disk cache of converted files keyed by a hash of everything that goes into a conversion.
+// manifest.json in the cache directory lists the entries; the least recently used ones are evicted
+// once the cache grows past its size limit.
+class OutputCache
+{
+public:
+	OutputCache(std::string directory, unsigned long long maxBytes);
+	~OutputCache();
+
+	static uint64_t HashBytes(const char* data, size_t length, uint64_t seed = 14695981039346656037ULL);
+	static uint64_t HashFile(std::string filePath, uint64_t seed = 14695981039346656037ULL);
+	static uint64_t HashOptions(const ExportOptions& options, uint64_t seed = 14695981039346656037ULL);
+	// Combines the mdl, the skeleton it will be rigged to, and the options. mdlData is the mdl's contents if they were already read.
+	static uint64_t HashJob(std::string mdlPath, const ExportOptions& options, const std::vector<char>* mdlData = NULL);
+
+	// Copies the cached files to where the conversion would have written them. False if there is no usable entry.
+	bool Restore(uint64_t hash, std::string outputPath);
+	void Store(uint64_t hash, std::string source, const std::vector<std::string>& outputPaths, bool separateLods);
+	void SaveManifest();
+
+private:
+	std::string directory;
+	unsigned long long maxBytes;
+	unsigned long long totalBytes = 0;
+	bool manifestChanged = false;
+	std::map<std::string, CacheEntry> Entries;
+
+	void LoadManifest();
+	void Evict();
+	void RemoveEntry(std::string key);
+	static std::string HashToKey(uint64_t hash);
+};
\ No newline at end of file
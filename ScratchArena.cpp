@@ -0,0 +1,54 @@
+#include "ScratchArena.h"
+
+ScratchArena::ScratchArena(size_t initialSize) {
+	bufferSize = initialSize;
+	buffer.reset(new char[bufferSize]);
+	resource.reset(new std::pmr::monotonic_buffer_resource(buffer.get(), bufferSize));
+}
+
+void ScratchArena::Release() {
+	resource.reset();
+
+	// Anything that spilled past the buffer came from the heap; grow so the next job of this size doesn't
+	if (bytesAllocated > bufferSize) {
+		bufferSize = bytesAllocated + bytesAllocated / 4;
+		buffer.reset(new char[bufferSize]);
+	}
+	bytesAllocated = 0;
+	resource.reset(new std::pmr::monotonic_buffer_resource(buffer.get(), bufferSize));
+}
+
+size_t ScratchArena::GetBytesAllocated() {
+	return bytesAllocated;
+}
+
+size_t ScratchArena::GetCapacity() {
+	return bufferSize;
+}
+
+std::pmr::string ScratchArena::Concat(std::initializer_list<std::string_view> parts) {
+	size_t length = 0;
+	for (auto it = parts.begin(); it != parts.end(); it++) {
+		length += it->size();
+	}
+
+	std::pmr::string ret(this);
+	ret.reserve(length);
+	for (auto it = parts.begin(); it != parts.end(); it++) {
+		ret.append(it->data(), it->size());
+	}
+	return ret;
+}
+
+void* ScratchArena::do_allocate(size_t bytes, size_t alignment) {
+	bytesAllocated += bytes + alignment;
+	return resource->allocate(bytes, alignment);
+}
+
+void ScratchArena::do_deallocate(void* p, size_t bytes, size_t alignment) {
+	// Monotonic, freed on Release
+}
+
+bool ScratchArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+	return this == &other;
+}
\ No newline at end of file
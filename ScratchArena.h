@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Monotonic arena for the short lived data of a conversion (part names, dedup tables, shape copies, weight maps).
+// Nothing is freed until Release, which drops everything at once. The arena keeps a buffer as large as the
+// biggest job it has seen, so in batch mode later jobs of the same size don't allocate at all.
+class ScratchArena : public std::pmr::memory_resource
+{
+public:
+	ScratchArena(size_t initialSize = 1 << 20);
+
+	void Release();
+	size_t GetBytesAllocated();
+	size_t GetCapacity();
+
+	// Builds a string out of the pieces without going through std::string temporaries
+	std::pmr::string Concat(std::initializer_list<std::string_view> parts);
+
+private:
+	std::unique_ptr<char[]> buffer;
+	size_t bufferSize;
+	size_t bytesAllocated = 0;
+	std::unique_ptr<std::pmr::monotonic_buffer_resource> resource;
+
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
\ No newline at end of file
@@ -1,73 +1,482 @@
 #include "Skeleton.h"
-#include "include/json.hpp"
+#include "Instrumentation.h"
 #include <iostream>
 #include <fstream>
-using json = nlohmann::json;
+#include <regex>
+#include <mutex>
+#include <map>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
 
-Bone* Skeleton::BuildSkeletonFromFile(std::string filePath) {
+struct CachedSkeleton {
+	std::shared_ptr<Bone> Root;
+	long long LastUsed = 0;
+};
 
-	std::ifstream ifs;
-	ifs.open(filePath);
-	fprintf(stdout, "Trying to read skeleton from %s\n", std::string(filePath).c_str());
+// Each combination of face, hair and tail is its own entry, so the cache is bounded rather than kept for the whole process
+static const int MaxCachedSkeletons = 32;
+static std::mutex skeletonCacheMutex;
+static std::map<std::string, CachedSkeleton> skeletonCache;
+static long long skeletonCacheUses = 0;
 
-	std::string s;
-	std::map<int, Bone*> boneNumbers;
-	std::map<int, int> boneNumberToParent;
-	Bone* ret = NULL;
+// One line of a .skel file
+struct SkeletonRecord {
+	int Number = -1;
+	int Parent = -1;
+	std::string Name;
+	double PoseMatrix[16];
+	int MatrixValues = 0;
+};
+
+// Reads the json lines of a .skel file in place, straight into SkeletonRecords, without building a json document.
+// Only what a .skel line can contain is supported: one object per line of numbers, strings and arrays of numbers.
+class SkeletonReader
+{
+public:
+	SkeletonReader(const char* data, size_t length, const char* sourceName) : pos(data), end(data + length), sourceName(sourceName) {}
+
+	// False at the end of the data. A line that can't be read is logged with its line number and skipped.
+	bool Next(SkeletonRecord& record) {
+		while (pos < end) {
+			line++;
+			lineStart = pos;
+			const char* lineEnd = (const char*)memchr(pos, '\n', end - pos);
+			if (lineEnd == NULL) lineEnd = end;
+
+			SkipSpace(lineEnd);
+			if (pos == lineEnd) {
+				pos = lineEnd + (lineEnd < end ? 1 : 0);
+				continue;
+			}
 
-	while (std::getline(ifs, s)) {
-		json data;
-		try {
-			data = json::parse(s);
-			int number = data.at("BoneNumber");
-			int parent = data.at("BoneParent");
-			std::string name = data.at("BoneName");
-			std::vector<double> matrixArr = data.at("PoseMatrix");
+			record = SkeletonRecord();
+			error = NULL;
+			bool read = ReadObject(record, lineEnd);
+			if (read && (record.Number < 0 || record.MatrixValues != 16)) {
+				Fail(record.Number < 0 ? "missing BoneNumber" : "PoseMatrix doesn't have 16 values");
+				read = false;
+			}
+			if (!read) {
+				Instrumentation::Log(LogLevel::Warning, "%s:%i:%i: %s", sourceName, line, (int)(pos - lineStart) + 1, error);
+			}
+			pos = lineEnd + (lineEnd < end ? 1 : 0);
+			if (read) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int GetErrorCount() { return errors; }
 
-			Bone* b = new Bone();
-			b->Name = name;
-			b->Number = number;
+private:
+	const char* pos;
+	const char* end;
+	const char* lineStart = NULL;
+	const char* sourceName;
+	const char* error = NULL;
+	int line = 0;
+	int errors = 0;
 
-			Eigen::Transform<double, 3, Eigen::Affine> matrix;
+	bool Fail(const char* message) {
+		if (error == NULL) {
+			error = message;
+			errors++;
+		}
+		return false;
+	}
+
+	void SkipSpace(const char* lineEnd) {
+		while (pos < lineEnd && (*pos == ' ' || *pos == '\t' || *pos == '\r')) pos++;
+	}
+
+	bool Expect(char c, const char* lineEnd) {
+		SkipSpace(lineEnd);
+		if (pos >= lineEnd || *pos != c) {
+			return Fail(c == ':' ? "expected ':'" : c == '{' ? "expected '{'" : "unexpected character");
+		}
+		pos++;
+		return true;
+	}
+
+	// Keys and bone names never have escapes in practice, but they are handled rather than misread
+	bool ReadString(std::string* out, const char* lineEnd) {
+		if (!Expect('"', lineEnd)) return Fail("expected a string");
+		const char* start = pos;
+		while (pos < lineEnd && *pos != '"') {
+			if (*pos == '\\') {
+				if (out != NULL) out->append(start, pos);
+				pos++;
+				if (pos >= lineEnd) break;
+				char escaped = *pos;
+				if (out != NULL) out->push_back(escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped);
+				start = pos + 1;
+			}
+			pos++;
+		}
+		if (pos >= lineEnd) return Fail("unterminated string");
+		if (out != NULL) out->append(start, pos);
+		pos++;
+		return true;
+	}
+
+	bool ReadNumber(double& value, const char* lineEnd) {
+		SkipSpace(lineEnd);
+		auto result = std::from_chars(pos, lineEnd, value);
+		if (result.ec != std::errc()) return Fail("expected a number");
+		pos = result.ptr;
+		return true;
+	}
+
+	bool ReadInt(int& value, const char* lineEnd) {
+		double number;
+		if (!ReadNumber(number, lineEnd)) return false;
+		value = (int)number;
+		return true;
+	}
+
+	bool ReadMatrix(SkeletonRecord& record, const char* lineEnd) {
+		if (!Expect('[', lineEnd)) return Fail("expected an array");
+		SkipSpace(lineEnd);
+		if (pos < lineEnd && *pos == ']') {
+			pos++;
+			return true;
+		}
+		while (true) {
+			double value;
+			if (!ReadNumber(value, lineEnd)) return false;
+			if (record.MatrixValues < 16) {
+				record.PoseMatrix[record.MatrixValues] = value;
+			}
+			record.MatrixValues++;
+			SkipSpace(lineEnd);
+			if (pos < lineEnd && *pos == ',') {
+				pos++;
+				continue;
+			}
+			return Expect(']', lineEnd);
+		}
+	}
 
-			for (int row = 0; row < 4; row++) {
-				for (int col = 0; col < 4; col++) {
-					matrix(row, col) = matrixArr[(col * 4) + row];
+	// Values of keys that aren't used: anything but nested objects, which a .skel line doesn't have
+	bool SkipValue(const char* lineEnd) {
+		SkipSpace(lineEnd);
+		if (pos >= lineEnd) return Fail("expected a value");
+		if (*pos == '"') return ReadString(NULL, lineEnd);
+		if (*pos == '[') {
+			int depth = 0;
+			for (; pos < lineEnd; pos++) {
+				if (*pos == '[') depth++;
+				else if (*pos == ']' && --depth == 0) {
+					pos++;
+					return true;
 				}
 			}
+			return Fail("unterminated array");
+		}
+		while (pos < lineEnd && *pos != ',' && *pos != '}') pos++;
+		return true;
+	}
+
+	bool ReadObject(SkeletonRecord& record, const char* lineEnd) {
+		if (!Expect('{', lineEnd)) return false;
+		std::string key;
+		while (true) {
+			SkipSpace(lineEnd);
+			if (pos < lineEnd && *pos == '}') {
+				pos++;
+				return true;
+			}
+			key.clear();
+			if (!ReadString(&key, lineEnd) || !Expect(':', lineEnd)) return false;
 
-			b->PoseMatrix = matrix;
-			boneNumbers.emplace(number, b);
+			bool read;
+			if (key == "BoneNumber") read = ReadInt(record.Number, lineEnd);
+			else if (key == "BoneParent") read = ReadInt(record.Parent, lineEnd);
+			else if (key == "BoneName") read = ReadString(&record.Name, lineEnd);
+			else if (key == "PoseMatrix") read = ReadMatrix(record, lineEnd);
+			else read = SkipValue(lineEnd);
+			if (!read) return false;
 
-			if (name == "n_root") {
-				ret = boneNumbers[number]; 
+			SkipSpace(lineEnd);
+			if (pos < lineEnd && *pos == ',') {
+				pos++;
+				continue;
 			}
+			return Expect('}', lineEnd) || Fail("expected ',' or '}'");
+		}
+	}
+};
+
+// Turns the records into bones hanging off of n_root
+static Bone* BuildSkeleton(const char* data, size_t length, const char* sourceName) {
+	SkeletonReader reader(data, length, sourceName);
+	std::vector<SkeletonRecord> records;
+	SkeletonRecord record;
+	while (reader.Next(record)) {
+		records.push_back(record);
+	}
+	Instrumentation::AddCount("skeleton_bones", records.size());
 
-			if (parent != -1) {
-				boneNumberToParent.emplace(number, parent);
+	std::map<int, Bone*> boneNumbers;
+	std::map<int, int> boneNumberToParent;
+	Bone* ret = NULL;
+	for (int i = 0; i < records.size(); i++) {
+		SkeletonRecord& r = records[i];
+		if (boneNumbers.find(r.Number) != boneNumbers.end()) {
+			Instrumentation::Log(LogLevel::Warning, "%s: bone number %i is used more than once, keeping the first", sourceName, r.Number);
+			continue;
+		}
+
+		Bone* b = new Bone();
+		b->Name = r.Name;
+		b->Number = r.Number;
+
+		Eigen::Transform<double, 3, Eigen::Affine> matrix;
+		for (int row = 0; row < 4; row++) {
+			for (int col = 0; col < 4; col++) {
+				matrix(row, col) = r.PoseMatrix[(col * 4) + row];
 			}
 		}
-		catch (json::parse_error& ex) {
-			std::cerr << "parse error at byte " << ex.byte << std::endl;
+		b->PoseMatrix = matrix;
+		boneNumbers.emplace(r.Number, b);
+
+		if (r.Name == "n_root") {
+			ret = b;
+		}
+		if (r.Parent != -1) {
+			boneNumberToParent.emplace(r.Number, r.Parent);
 		}
 	}
-	ifs.close();
+
 	std::map<int, Bone*>::iterator it;
 	for (it = boneNumbers.begin(); it != boneNumbers.end(); it++) {
-		int num = it->first;
 		Bone* b = it->second;
-
-		auto parentIt = boneNumberToParent.find(num);
-		if (parentIt != boneNumberToParent.end()) {
-			Bone* p = boneNumbers.find(parentIt->second)->second;
-			p->Children.push_back(b);
-			b->Parent = p;
+		auto parentIt = boneNumberToParent.find(it->first);
+		if (parentIt == boneNumberToParent.end()) {
+			continue;
 		}
+		auto p = boneNumbers.find(parentIt->second);
+		if (p == boneNumbers.end()) {
+			Instrumentation::Log(LogLevel::Warning, "%s: the parent of bone %s doesn't exist", sourceName, b->Name.c_str());
+			continue;
+		}
+		p->second->Children.push_back(b);
+		b->Parent = p->second;
 	}
-	
 
+	Skeleton::ComputeWorldMatrices(ret);
 	return ret;
 }
+
+// Maps the file rather than reading it, so a cold load is one pass over the page cache
+Bone* Skeleton::BuildSkeletonFromFile(std::string filePath) {
+	ScopedTimer timer("LoadSkeleton");
+	Instrumentation::Log(LogLevel::Info, "Trying to read skeleton from %s", filePath.c_str());
+
+	HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		Instrumentation::Log(LogLevel::Warning, "Could not open skeleton %s", filePath.c_str());
+		return NULL;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return NULL;
+	}
+
+	Bone* ret = NULL;
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL) {
+		const char* data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data != NULL) {
+			ret = BuildSkeleton(data, (size_t)size.QuadPart, filePath.c_str());
+			UnmapViewOfFile(data);
+		}
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	return ret;
+}
+
 Bone* Skeleton::BuildSkeletonFromData(const char* data) {
-	return NULL;
+	if (data == NULL) {
+		return NULL;
+	}
+	return BuildSkeletonFromData(data, strlen(data));
+}
+
+Bone* Skeleton::BuildSkeletonFromData(const char* data, size_t length) {
+	ScopedTimer timer("LoadSkeleton");
+	if (data == NULL) {
+		return NULL;
+	}
+	return BuildSkeleton(data, length, "skeleton data");
 }
+
+static void DeleteBones(Bone* bone) {
+	for (int i = 0; i < bone->Children.size(); i++) {
+		DeleteBones(bone->Children[i]);
+	}
+	delete bone;
+}
+
+void Skeleton::DeleteSkeleton(Bone* root) {
+	if (root != NULL) {
+		DeleteBones(root);
+	}
+}
+
+static int GetLargestBoneNumber(Bone* bone) {
+	int ret = bone->Number;
+	for (int i = 0; i < bone->Children.size(); i++) {
+		ret = std::max(ret, GetLargestBoneNumber(bone->Children[i]));
+	}
+	return ret;
+}
+
+// Supplementary skeleton files repeat the body bones their own bones hang off of, e.g. a face has n_root -> ... -> j_kao -> face bones
+static void MergeBone(Bone* body, Bone* bone, Bone* mergedParent, int& nextNumber) {
+	Bone* existing = body->GetBone(bone->Name);
+	std::vector<Bone*> children = bone->Children;
+
+	if (existing == NULL) {
+		bone->Children.clear();
+		bone->Parent = mergedParent;
+		bone->Number = nextNumber++;
+		mergedParent->Children.push_back(bone);
+		existing = bone;
+	}
+	for (int i = 0; i < children.size(); i++) {
+		MergeBone(body, children[i], existing, nextNumber);
+	}
+	if (existing != bone) {
+		delete bone;
+	}
+}
+
+void Skeleton::MergeSkeleton(Bone* body, Bone* supplementary) {
+	if (body == NULL || supplementary == NULL) return;
+
+	int nextNumber = GetLargestBoneNumber(body) + 1;
+	// A root the body doesn't know about goes under the body's root
+	MergeBone(body, supplementary, body, nextNumber);
+}
+
+std::shared_ptr<Bone> Skeleton::BuildMergedSkeleton(std::string bodyPath, const std::vector<std::string>& supplementaryPaths) {
+	std::string key = bodyPath;
+	for (int i = 0; i < supplementaryPaths.size(); i++) {
+		key += "|" + supplementaryPaths[i];
+	}
+
+	std::lock_guard<std::mutex> lock(skeletonCacheMutex);
+	auto it = skeletonCache.find(key);
+	if (it != skeletonCache.end()) {
+		Instrumentation::AddCount("skeleton_cache_hits", 1);
+		it->second.LastUsed = ++skeletonCacheUses;
+		return it->second.Root;
+	}
+
+	Bone* root = BuildSkeletonFromFile(bodyPath);
+	if (root == NULL) {
+		// Not cached, so a skeleton that turns up later is picked up
+		return nullptr;
+	}
+	for (int i = 0; i < supplementaryPaths.size(); i++) {
+		Bone* supplementary = BuildSkeletonFromFile(supplementaryPaths[i]);
+		if (supplementary == NULL) {
+			Instrumentation::Log(LogLevel::Warning, "Could not read supplementary skeleton %s", supplementaryPaths[i].c_str());
+			continue;
+		}
+		MergeSkeleton(root, supplementary);
+	}
+	ComputeWorldMatrices(root);
+
+	// Least recently used goes first
+	while (skeletonCache.size() >= MaxCachedSkeletons) {
+		auto oldest = skeletonCache.begin();
+		for (auto entry = skeletonCache.begin(); entry != skeletonCache.end(); entry++) {
+			if (entry->second.LastUsed < oldest->second.LastUsed) {
+				oldest = entry;
+			}
+		}
+		skeletonCache.erase(oldest);
+	}
+
+	CachedSkeleton cached;
+	cached.Root = std::shared_ptr<Bone>(root, DeleteBones);
+	cached.LastUsed = ++skeletonCacheUses;
+	skeletonCache.emplace(key, cached);
+	return cached.Root;
+}
+
+std::vector<std::string> Skeleton::GetSupplementarySkeletonPaths(std::string modelPath, std::string bodyPath) {
+	std::vector<std::string> ret;
+	std::string directory = "";
+	size_t separator = bodyPath.find_last_of("\\/");
+	if (separator != std::string::npos) {
+		directory = bodyPath.substr(0, separator + 1);
+	}
+
+	// c0101f0001, c0101h0010, c1401t0002, ...
+	std::regex supplementaryRegex("c[0-9]{4}[fht][0-9]{4}");
+	auto begin = std::sregex_iterator(modelPath.begin(), modelPath.end(), supplementaryRegex);
+	for (auto it = begin; it != std::sregex_iterator(); it++) {
+		std::string path = directory + it->str() + ".skel";
+		if (std::find(ret.begin(), ret.end(), path) != ret.end()) {
+			continue;
+		}
+		std::ifstream exists(path);
+		if (exists.good()) {
+			ret.push_back(path);
+		}
+	}
+	return ret;
+}
+
+std::string Skeleton::GetBodySkeletonPath(std::string modelPath, std::string bodyPath) {
+	std::string directory = "";
+	size_t separator = bodyPath.find_last_of("\\/");
+	if (separator != std::string::npos) {
+		directory = bodyPath.substr(0, separator + 1);
+	}
+
+	// The race is the first four digits of c0101b0001, c1401f0001, c0201e6016, ...
+	std::regex raceRegex("c([0-9]{4})[a-z][0-9]{4}");
+	std::smatch match;
+	if (!std::regex_search(modelPath, match, raceRegex)) {
+		return bodyPath;
+	}
+	std::string path = directory + "c" + match[1].str() + "b0001.skel";
+	std::ifstream exists(path);
+	return exists.good() ? path : bodyPath;
+}
+
+void Skeleton::ClearSkeletonCache() {
+	std::lock_guard<std::mutex> lock(skeletonCacheMutex);
+	// Skeletons still in use are deleted once their conversions finish with them
+	skeletonCache.clear();
+}
+
+std::vector<Bone*> Skeleton::ComputeWorldMatrices(Bone* root) {
+	std::vector<Bone*> ordered;
+	if (root == NULL) return ordered;
+
+	// Breadth first, so every parent's world matrix is ready before its children need it
+	ordered.push_back(root);
+	for (size_t i = 0; i < ordered.size(); i++) {
+		Bone* b = ordered[i];
+		if (b->Parent == NULL || b == root) {
+			b->WorldMatrix = b->PoseMatrix.matrix();
+		}
+		else {
+			b->WorldMatrix.noalias() = b->Parent->WorldMatrix * b->PoseMatrix.matrix();
+		}
+		ordered.insert(ordered.end(), b->Children.begin(), b->Children.end());
+	}
+	return ordered;
+}
\ No newline at end of file
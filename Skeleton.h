@@ -1,11 +1,32 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <memory>
 #include "Bone.h"
 static class Skeleton
 {
 public:
-	// TODO: Build skeleton from other sources
+	// Both read the json lines of a .skel file; a line that can't be read is logged with its line number and skipped
 	static Bone* BuildSkeletonFromFile(std::string filePath);
+	// data is null terminated
 	static Bone* BuildSkeletonFromData(const char* data);
+	static Bone* BuildSkeletonFromData(const char* data, size_t length);
+
+	// Loads the body skeleton and merges every supplementary skeleton (face, hair, tail) into it by parent name.
+	// The result is cached per combination of paths and shared between conversions, so it must not be modified.
+	// Only the most recently used skeletons are kept; one dropped from the cache lives on until its last user lets go.
+	static std::shared_ptr<Bone> BuildMergedSkeleton(std::string bodyPath, const std::vector<std::string>& supplementaryPaths);
+	// Moves every bone of supplementary that isn't already in body under its parent in body. Deletes what is left of supplementary.
+	static void MergeSkeleton(Bone* body, Bone* supplementary);
+	// The face/hair/tail skeletons that exist next to bodyPath for a model path like ".../c0101f0001_fac.mdl"
+	static std::vector<std::string> GetSupplementarySkeletonPaths(std::string modelPath, std::string bodyPath);
+	// The body skeleton of the race in a model path like ".../c1401f0001_fac.mdl", next to bodyPath.
+	// bodyPath itself if the path has no race or there is no skeleton for it.
+	static std::string GetBodySkeletonPath(std::string modelPath, std::string bodyPath);
+	static void ClearSkeletonCache();
+	// Deletes root and every bone under it. Only for skeletons that aren't from BuildMergedSkeleton.
+	static void DeleteSkeleton(Bone* root);
+	// Fills in every bone's WorldMatrix, parents before children, and returns the bones in that order
+	static std::vector<Bone*> ComputeWorldMatrices(Bone* root);
 };
 
@@ -0,0 +1,242 @@
+#include "TangentGenerator.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+static const float Pi = 3.14159265358979f;
+
+// Abramowitz and Stegun 4.4.45, within 7e-5 radians. No branches, so the corner loop stays vectorisable.
+static inline float FastAcos(float x) {
+	float ax = std::fmin(std::fabs(x), 1.0f);
+	float r = std::sqrt(1.0f - ax) * (1.5707288f + ax * (-0.2121144f + ax * (0.0742610f + ax * -0.0187293f)));
+	return x < 0 ? Pi - r : r;
+}
+
+static int FindRoot(std::pmr::vector<int>& parents, int i) {
+	while (parents[i] != i) {
+		parents[i] = parents[parents[i]];
+		i = parents[i];
+	}
+	return i;
+}
+
+void TangentGenerator::Generate(std::pmr::vector<Vertex>& vertices, std::pmr::vector<int>& indices, std::pmr::vector<int>& splitFrom) {
+	size_t triangleCount = indices.size() / 3;
+	size_t cornerCount = triangleCount * 3;
+	if (triangleCount == 0 || vertices.size() == 0) {
+		return;
+	}
+	std::pmr::memory_resource* resource = vertices.get_allocator().resource();
+
+	// Corner attributes gathered once, structure of arrays, so the triangle loop below only streams through them
+	std::pmr::vector<float> corners(cornerCount * 8, resource);
+	float* px = corners.data();
+	float* py = px + cornerCount;
+	float* pz = py + cornerCount;
+	float* nx = pz + cornerCount;
+	float* ny = nx + cornerCount;
+	float* nz = ny + cornerCount;
+	float* u = nz + cornerCount;
+	float* v = u + cornerCount;
+	for (size_t c = 0; c < cornerCount; c++) {
+		const Vertex& vertex = vertices[indices[c]];
+		px[c] = vertex.Position[0];
+		py[c] = vertex.Position[1];
+		pz[c] = vertex.Position[2];
+		nx[c] = vertex.Normal[0];
+		ny[c] = vertex.Normal[1];
+		nz[c] = vertex.Normal[2];
+		u[c] = vertex.UV[0];
+		v[c] = vertex.UV[1];
+	}
+
+	// Each corner's angle weighted, normal projected face tangent, and each triangle's uv orientation
+	std::pmr::vector<float> contributions(cornerCount * 3, resource);
+	float* cx = contributions.data();
+	float* cy = cx + cornerCount;
+	float* cz = cy + cornerCount;
+	std::pmr::vector<uint8_t> orientation(triangleCount, resource);
+	std::pmr::vector<uint8_t> degenerate(triangleCount, resource);
+	for (size_t t = 0; t < triangleCount; t++) {
+		size_t c0 = t * 3;
+		float e1x = px[c0 + 1] - px[c0], e1y = py[c0 + 1] - py[c0], e1z = pz[c0 + 1] - pz[c0];
+		float e2x = px[c0 + 2] - px[c0], e2y = py[c0 + 2] - py[c0], e2z = pz[c0 + 2] - pz[c0];
+		float du1 = u[c0 + 1] - u[c0], dv1 = v[c0 + 1] - v[c0];
+		float du2 = u[c0 + 2] - u[c0], dv2 = v[c0 + 2] - v[c0];
+
+		// Only the direction matters, so the signed uv area only contributes its sign
+		float area = du1 * dv2 - du2 * dv1;
+		float tx = dv2 * e1x - dv1 * e2x;
+		float ty = dv2 * e1y - dv1 * e2y;
+		float tz = dv2 * e1z - dv1 * e2z;
+		float length = std::sqrt(tx * tx + ty * ty + tz * tz);
+		float scale = (area != 0 && length > 0) ? (area > 0 ? 1.0f : -1.0f) / length : 0.0f;
+		tx *= scale;
+		ty *= scale;
+		tz *= scale;
+		orientation[t] = area > 0;
+		degenerate[t] = area == 0;
+
+		for (int k = 0; k < 3; k++) {
+			size_t c = c0 + k;
+			size_t next = c0 + (k == 2 ? 0 : k + 1);
+			size_t prev = c0 + (k == 0 ? 2 : k - 1);
+			float n0 = nx[c], n1 = ny[c], n2 = nz[c];
+
+			float nt = n0 * tx + n1 * ty + n2 * tz;
+			float ox = tx - n0 * nt, oy = ty - n1 * nt, oz = tz - n2 * nt;
+			float oLength = std::sqrt(ox * ox + oy * oy + oz * oz);
+
+			// The corner's angle, measured on the plane of its normal
+			float ax = px[next] - px[c], ay = py[next] - py[c], az = pz[next] - pz[c];
+			float bx = px[prev] - px[c], by = py[prev] - py[c], bz = pz[prev] - pz[c];
+			float na = n0 * ax + n1 * ay + n2 * az;
+			float nb = n0 * bx + n1 * by + n2 * bz;
+			ax -= n0 * na; ay -= n1 * na; az -= n2 * na;
+			bx -= n0 * nb; by -= n1 * nb; bz -= n2 * nb;
+			float lengths = std::sqrt((ax * ax + ay * ay + az * az) * (bx * bx + by * by + bz * bz));
+			float cosine = lengths > 0 ? (ax * bx + ay * by + az * bz) / lengths : 1.0f;
+			float weight = FastAcos(cosine) * (oLength > 0 ? 1.0f / oLength : 0.0f);
+
+			cx[c] = ox * weight;
+			cy[c] = oy * weight;
+			cz[c] = oz * weight;
+		}
+	}
+
+	// Triangles across each edge: the same two vertices, wound the other way. Edges are bucketed by their lower
+	// vertex, and the few edges in a bucket are matched by their other vertex.
+	size_t vertexCount = vertices.size();
+	std::pmr::vector<int> bucketStart(vertexCount + 1, 0, resource);
+	for (size_t c = 0; c < cornerCount; c++) {
+		int a = indices[c];
+		int b = indices[c % 3 == 2 ? c - 2 : c + 1];
+		bucketStart[std::min(a, b) + 1]++;
+	}
+	for (size_t i = 0; i < vertexCount; i++) {
+		bucketStart[i + 1] += bucketStart[i];
+	}
+	std::pmr::vector<int> bucketFill(bucketStart.begin(), bucketStart.end() - 1, resource);
+	std::pmr::vector<int> bucketCorners(cornerCount, resource);
+	for (size_t c = 0; c < cornerCount; c++) {
+		int a = indices[c];
+		int b = indices[c % 3 == 2 ? c - 2 : c + 1];
+		bucketCorners[bucketFill[std::min(a, b)]++] = c;
+	}
+	// neighbours[corner] is the corner on the other side of the edge that starts at it, or -1
+	std::pmr::vector<int> neighbours(cornerCount, -1, resource);
+	for (size_t bucket = 0; bucket < vertexCount; bucket++) {
+		for (int i = bucketStart[bucket]; i < bucketStart[bucket + 1]; i++) {
+			int ci = bucketCorners[i];
+			int ai = indices[ci];
+			int bi = indices[ci % 3 == 2 ? ci - 2 : ci + 1];
+			for (int j = i + 1; j < bucketStart[bucket + 1] && neighbours[ci] == -1; j++) {
+				int cj = bucketCorners[j];
+				// The same edge the other way round, in another triangle
+				if (neighbours[cj] == -1 && cj / 3 != ci / 3 && indices[cj] == bi && indices[cj % 3 == 2 ? cj - 2 : cj + 1] == ai) {
+					neighbours[ci] = cj;
+					neighbours[cj] = ci;
+				}
+			}
+		}
+	}
+
+	// Triangles without uv area join whichever orientation reaches them first, spreading from the ones that have one
+	std::pmr::vector<int> queue(resource);
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (!degenerate[t]) queue.push_back(t);
+	}
+	for (size_t q = 0; q < queue.size(); q++) {
+		int t = queue[q];
+		for (int k = 0; k < 3; k++) {
+			int other = neighbours[t * 3 + k];
+			if (other != -1 && degenerate[other / 3]) {
+				degenerate[other / 3] = 0;
+				orientation[other / 3] = orientation[t];
+				queue.push_back(other / 3);
+			}
+		}
+	}
+
+	// Corners of the same vertex in triangles joined by an edge with the same orientation share a tangent space group
+	std::pmr::vector<int> parents(cornerCount, resource);
+	for (size_t c = 0; c < cornerCount; c++) {
+		parents[c] = c;
+	}
+	for (size_t c = 0; c < cornerCount; c++) {
+		int other = neighbours[c];
+		if (other == -1 || other < (int)c || orientation[c / 3] != orientation[other / 3]) {
+			continue;
+		}
+		// Edge c -> c+1 in this triangle runs other+1 -> other in the neighbour
+		size_t cNext = c % 3 == 2 ? c - 2 : c + 1;
+		size_t otherNext = other % 3 == 2 ? other - 2 : other + 1;
+		parents[FindRoot(parents, c)] = FindRoot(parents, otherNext);
+		parents[FindRoot(parents, cNext)] = FindRoot(parents, other);
+	}
+
+	std::pmr::vector<float> sums(cornerCount * 3, 0.0f, resource);
+	for (size_t c = 0; c < cornerCount; c++) {
+		int root = FindRoot(parents, c);
+		sums[root * 3] += cx[c];
+		sums[root * 3 + 1] += cy[c];
+		sums[root * 3 + 2] += cz[c];
+	}
+
+	// The first group of a vertex keeps it, every other group gets a copy
+	size_t originalCount = vertices.size();
+	std::pmr::vector<int> vertexGroup(originalCount, -1, resource);
+	std::pmr::vector<int> groupVertex(cornerCount, -1, resource);
+	for (size_t c = 0; c < cornerCount; c++) {
+		int root = FindRoot(parents, c);
+		int vi = indices[c];
+		if (groupVertex[root] == -1) {
+			if (vertexGroup[vi] == -1) {
+				vertexGroup[vi] = root;
+				groupVertex[root] = vi;
+			}
+			else {
+				groupVertex[root] = vertices.size();
+				splitFrom.push_back(vi);
+				vertices.push_back(vertices[vi]);
+			}
+		}
+		indices[c] = groupVertex[root];
+	}
+
+	for (size_t c = 0; c < cornerCount; c++) {
+		int root = FindRoot(parents, c);
+		if ((size_t)root != c) {
+			continue;
+		}
+		Vertex& vertex = vertices[groupVertex[root]];
+		const float* n = vertex.Normal;
+		float t[3] = { sums[root * 3], sums[root * 3 + 1], sums[root * 3 + 2] };
+		float length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+		if (length < 1e-12f) {
+			// No uv derivative anywhere around the vertex: any direction perpendicular to the normal
+			float axis[3] = { 1, 0, 0 };
+			if (std::fabs(n[0]) > 0.9f) {
+				axis[0] = 0;
+				axis[1] = 1;
+			}
+			float na = n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2];
+			for (int i = 0; i < 3; i++) {
+				t[i] = axis[i] - n[i] * na;
+			}
+			length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+		}
+		for (int i = 0; i < 3; i++) {
+			t[i] /= length;
+		}
+
+		float handedness = orientation[c / 3] ? 1.0f : -1.0f;
+		float cross[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+		for (int i = 0; i < 3; i++) {
+			vertex.Tangent2[i] = t[i];
+			vertex.Tangent1[i] = cross[i] * handedness;
+		}
+		vertex.Tangent2[3] = handedness;
+		vertex.Tangent1[3] = handedness;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include <memory_resource>
+#include "LuminaPlusPlus/Models/Models/Vertex.h"
+
+// Tangent frames following MikkTSpace's rules, so they match what MikkTSpace based tools bake against.
+//
+// Every corner gets its triangle's uv derivative projected onto the vertex normal, weighted by the corner's angle.
+// Corners of a vertex are summed per tangent space group: triangles around the vertex that are joined by shared
+// edges and have the same uv orientation. A triangle without uv area takes the orientation of its neighbours.
+// A vertex with more than one group, such as one on a mirrored uv seam, is split so each group gets its own frame.
+//
+// The two differences from the reference implementation: corner angles come from a polynomial acos, within 1e-4
+// radians, and the angular threshold that can split a group further is left at MikkTSpace's default of 180
+// degrees, which never splits.
+static class TangentGenerator
+{
+public:
+	// Fills Tangent2 with the tangent and Tangent1 with the bitangent, handedness in w, as the game stores them.
+	// indices are relative to vertices. Split vertices are appended as copies, indices are pointed at them, and
+	// splitFrom gets the vertex each copy was made from.
+	static void Generate(std::pmr::vector<Vertex>& vertices, std::pmr::vector<int>& indices, std::pmr::vector<int>& splitFrom);
+};
\ No newline at end of file
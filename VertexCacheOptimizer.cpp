@@ -0,0 +1,121 @@
+#include "VertexCacheOptimizer.h"
+#include <algorithm>
+
+int VertexCacheOptimizer::CountCacheMisses(const int* indices, size_t indexCount, int vertexCount, int cacheSize) {
+	// A vertex is in the cache if it was added within the last cacheSize misses
+	std::vector<int> addedAt(vertexCount, -1);
+	int misses = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		int v = indices[i];
+		if (addedAt[v] == -1 || misses - addedAt[v] >= cacheSize) {
+			addedAt[v] = misses;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+void VertexCacheOptimizer::OptimizeTriangleOrder(int* indices, size_t indexCount, int vertexCount, std::pmr::memory_resource* resource, int cacheSize) {
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// Triangles that use each vertex, as offsets into one flat array
+	std::pmr::vector<int> live(vertexCount + 1, 0, resource);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		live[indices[i]]++;
+	}
+	std::pmr::vector<int> adjacencyOffsets(vertexCount + 1, 0, resource);
+	for (int v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + live[v];
+	}
+	std::pmr::vector<int> adjacency(triangleCount * 3, 0, resource);
+	std::pmr::vector<int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1, resource);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	std::pmr::vector<int> cacheTime(vertexCount, 0, resource);
+	std::pmr::vector<char> emitted(triangleCount, 0, resource);
+	std::pmr::vector<int> deadEnd(resource);
+	std::pmr::vector<int> candidates(resource);
+	std::pmr::vector<int> output(resource);
+	output.reserve(triangleCount * 3);
+
+	int time = cacheSize + 1;
+	int cursor = 0;
+	int fanning = 0;
+
+	while (fanning >= 0) {
+		candidates.clear();
+		for (int a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++) {
+			int t = adjacency[a];
+			if (emitted[t]) continue;
+
+			for (int c = 0; c < 3; c++) {
+				int v = indices[t * 3 + c];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cacheTime[v] > cacheSize) {
+					cacheTime[v] = time;
+					time++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		// Prefer the candidate that will still be in the cache once all of its remaining triangles are emitted
+		int next = -1;
+		int best = -1;
+		for (int i = 0; i < candidates.size(); i++) {
+			int v = candidates[i];
+			if (live[v] <= 0) continue;
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize) {
+				priority = time - cacheTime[v];
+			}
+			if (priority > best) {
+				best = priority;
+				next = v;
+			}
+		}
+
+		// Dead end: go back to something recently used, and failing that, to the next vertex with triangles left
+		while (next == -1 && deadEnd.size() > 0) {
+			int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (live[v] > 0) {
+				next = v;
+			}
+		}
+		while (next == -1 && cursor < vertexCount) {
+			if (live[cursor] > 0) {
+				next = cursor;
+			}
+			cursor++;
+		}
+		fanning = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void VertexCacheOptimizer::OptimizeVertexOrder(int* indices, size_t indexCount, int vertexCount, std::pmr::vector<int>& oldToNew) {
+	oldToNew.assign(vertexCount, -1);
+	int next = 0;
+	for (size_t i = 0; i < indexCount; i++) {
+		int& newIndex = oldToNew[indices[i]];
+		if (newIndex == -1) {
+			newIndex = next++;
+		}
+		indices[i] = newIndex;
+	}
+	for (int v = 0; v < vertexCount; v++) {
+		if (oldToNew[v] == -1) {
+			oldToNew[v] = next++;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory_resource>
+#include <vector>
+
+// Reorders a triangle list for the GPU's post-transform vertex cache, then its vertices for fetch locality.
+// Indices are relative to the part's own vertices.
+static class VertexCacheOptimizer
+{
+public:
+	// Misses of a FIFO cache of cacheSize vertices; divided by the triangle count this is the ACMR
+	static int CountCacheMisses(const int* indices, size_t indexCount, int vertexCount, int cacheSize = 32);
+	// Tipsify (Sander, Nehab, Barczak 2007): fans around recently used vertices, in linear time
+	static void OptimizeTriangleOrder(int* indices, size_t indexCount, int vertexCount, std::pmr::memory_resource* resource, int cacheSize = 16);
+	// Numbers vertices in the order the indices first use them and rewrites the indices to match.
+	// oldToNew tells the caller how to move the vertices and anything keyed by them. Unused vertices go last.
+	static void OptimizeVertexOrder(int* indices, size_t indexCount, int vertexCount, std::pmr::vector<int>& oldToNew);
+};
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "VertexStreams.h"
+#include <cstring>
+#include <cmath>
+
+// Round to nearest even, with overflow going to infinity and small values to (sub)normals
+uint16_t FloatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint16_t sign = (bits >> 16) & 0x8000;
+	int exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (((bits >> 23) & 0xFF) == 0xFF) {
+		// Inf or NaN
+		return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+	}
+	if (exponent >= 31) {
+		return sign | 0x7C00;
+	}
+	if (exponent <= 0) {
+		if (exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) {
+			half++;
+		}
+		return sign | (uint16_t)half;
+	}
+
+	uint16_t half = sign | (uint16_t)(exponent << 10) | (uint16_t)(mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1FFF;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+		// Carries into the exponent correctly, up to infinity
+		half++;
+	}
+	return half;
+}
+
+float HalfToFloat(uint16_t value) {
+	uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+	uint32_t exponent = (value >> 10) & 0x1F;
+	uint32_t mantissa = value & 0x3FF;
+	uint32_t bits;
+
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		}
+		else {
+			// Subnormal, normalise it
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			mantissa &= 0x3FF;
+			bits = sign | (exponent << 23) | (mantissa << 13);
+		}
+	}
+	else if (exponent == 31) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	float ret;
+	memcpy(&ret, &bits, sizeof(ret));
+	return ret;
+}
+
+static unsigned char PackUnorm8(float value) {
+	if (value <= 0.0f) return 0;
+	if (value >= 1.0f) return 255;
+	return (unsigned char)std::lround(value * 255.0f);
+}
+
+VertexStreams::VertexStreams(std::pmr::memory_resource* resource, bool packed)
+	: Positions(resource), Normals(resource), packed(packed), uvs(resource), packedUvs(resource), colors(resource),
+	packedColors(resource), blendIndices(resource), blendWeights(resource), packedBlendWeights(resource) {
+}
+
+void VertexStreams::Reserve(size_t count) {
+	Positions.reserve(count * 3);
+	Normals.reserve(count * 3);
+	blendIndices.reserve(count * 4);
+	if (packed) {
+		packedUvs.reserve(count * 4);
+		packedColors.reserve(count * 4);
+		packedBlendWeights.reserve(count * 4);
+	}
+	else {
+		uvs.reserve(count * 4);
+		colors.reserve(count * 4);
+		blendWeights.reserve(count * 4);
+	}
+}
+
+void VertexStreams::Append(const Vertex& v) {
+	for (int c = 0; c < 3; c++) {
+		Positions.push_back(v.Position[c]);
+		Normals.push_back(v.Normal[c]);
+	}
+	for (int c = 0; c < 4; c++) {
+		blendIndices.push_back(v.BlendIndices[c]);
+		if (packed) {
+			packedUvs.push_back(FloatToHalf(v.UV[c]));
+			packedColors.push_back(PackUnorm8(v.Color[c]));
+			packedBlendWeights.push_back(PackUnorm8(v.BlendWeights[c]));
+		}
+		else {
+			uvs.push_back(v.UV[c]);
+			colors.push_back(v.Color[c]);
+			blendWeights.push_back(v.BlendWeights[c]);
+		}
+	}
+	count++;
+}
+
+size_t VertexStreams::size() const {
+	return count;
+}
+
+bool VertexStreams::IsPacked() const {
+	return packed;
+}
+
+const float* VertexStreams::Position(size_t i) const {
+	return &Positions[i * 3];
+}
+
+const float* VertexStreams::Normal(size_t i) const {
+	return &Normals[i * 3];
+}
+
+float VertexStreams::UV(size_t i, int component) const {
+	return packed ? HalfToFloat(packedUvs[i * 4 + component]) : uvs[i * 4 + component];
+}
+
+float VertexStreams::Color(size_t i, int component) const {
+	return packed ? packedColors[i * 4 + component] / 255.0f : colors[i * 4 + component];
+}
+
+unsigned char VertexStreams::BlendIndex(size_t i, int w) const {
+	return blendIndices[i * 4 + w];
+}
+
+float VertexStreams::BlendWeight(size_t i, int w) const {
+	return packed ? packedBlendWeights[i * 4 + w] / 255.0f : blendWeights[i * 4 + w];
+}
+
+const unsigned char* VertexStreams::PackedBlendWeights(size_t i) const {
+	return &packedBlendWeights[i * 4];
+}
+
+const unsigned char* VertexStreams::PackedColor(size_t i) const {
+	return &packedColors[i * 4];
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory_resource>
+#include <vector>
+#include <cstdint>
+#include "LuminaPlusPlus/Models/Models/Vertex.h"
+
+// Converts between float and IEEE half precision
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+// Structure-of-arrays copy of the vertices a part actually uses, so each stage only walks the streams it reads.
+// Positions and normals stay float. When packed, uvs are half floats, and colours and weights are unorm8,
+// which is the precision the game stores them at anyway.
+class VertexStreams
+{
+public:
+	VertexStreams(std::pmr::memory_resource* resource, bool packed = false);
+
+	void Append(const Vertex& v);
+	void Reserve(size_t count);
+	size_t size() const;
+	bool IsPacked() const;
+
+	// xyz
+	const float* Position(size_t i) const;
+	const float* Normal(size_t i) const;
+	// uv: 0/1 are the first uv set, 2/3 the second
+	float UV(size_t i, int component) const;
+	float Color(size_t i, int component) const;
+	unsigned char BlendIndex(size_t i, int w) const;
+	float BlendWeight(size_t i, int w) const;
+	// The raw unorm8 weights, only valid when packed
+	const unsigned char* PackedBlendWeights(size_t i) const;
+	const unsigned char* PackedColor(size_t i) const;
+
+	std::pmr::vector<float> Positions;
+	std::pmr::vector<float> Normals;
+
+private:
+	bool packed;
+	size_t count = 0;
+
+	std::pmr::vector<float> uvs;
+	std::pmr::vector<uint16_t> packedUvs;
+	std::pmr::vector<float> colors;
+	std::pmr::vector<unsigned char> packedColors;
+	std::pmr::vector<unsigned char> blendIndices;
+	std::pmr::vector<float> blendWeights;
+	std::pmr::vector<unsigned char> packedBlendWeights;
+};
\ No newline at end of file
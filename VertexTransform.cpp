@@ -0,0 +1,177 @@
+#include "VertexTransform.h"
+#include <cmath>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// MSVC compiles intrinsics for any instruction set; gcc and clang have to be told per function
+#if defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+void Bounds::Add(const float* point) {
+	for (int c = 0; c < 3; c++) {
+		Min[c] = point[c] < Min[c] ? point[c] : Min[c];
+		Max[c] = point[c] > Max[c] ? point[c] : Max[c];
+	}
+}
+
+void Bounds::Add(const Bounds& other) {
+	if (other.IsEmpty()) {
+		return;
+	}
+	Add(other.Min);
+	Add(other.Max);
+}
+
+bool Bounds::IsEmpty() const {
+	return Min[0] > Max[0];
+}
+
+bool VertexTransform::HasAvx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+void VertexTransform::TransformScalar(const float matrix[16], const float normalMatrix[16], VertexArrays& v, size_t first, Bounds& bounds) {
+	const float* m = matrix;
+	const float* n = normalMatrix;
+	for (size_t i = first; i < v.Count; i++) {
+		float x = v.X[i], y = v.Y[i], z = v.Z[i];
+		float p[3] = {
+			x * m[0] + y * m[4] + z * m[8] + m[12],
+			x * m[1] + y * m[5] + z * m[9] + m[13],
+			x * m[2] + y * m[6] + z * m[10] + m[14]
+		};
+		v.X[i] = p[0];
+		v.Y[i] = p[1];
+		v.Z[i] = p[2];
+		bounds.Add(p);
+
+		float nx = v.NX[i], ny = v.NY[i], nz = v.NZ[i];
+		float tx = nx * n[0] + ny * n[4] + nz * n[8];
+		float ty = nx * n[1] + ny * n[5] + nz * n[9];
+		float tz = nx * n[2] + ny * n[6] + nz * n[10];
+		float length = std::sqrt(tx * tx + ty * ty + tz * tz);
+		float scale = length > 0 ? 1.0f / length : 0.0f;
+		v.NX[i] = tx * scale;
+		v.NY[i] = ty * scale;
+		v.NZ[i] = tz * scale;
+	}
+}
+
+static void StoreBounds(__m128 minX, __m128 minY, __m128 minZ, __m128 maxX, __m128 maxY, __m128 maxZ, Bounds& bounds) {
+	float lanes[6][4];
+	_mm_storeu_ps(lanes[0], minX);
+	_mm_storeu_ps(lanes[1], minY);
+	_mm_storeu_ps(lanes[2], minZ);
+	_mm_storeu_ps(lanes[3], maxX);
+	_mm_storeu_ps(lanes[4], maxY);
+	_mm_storeu_ps(lanes[5], maxZ);
+	for (int l = 0; l < 4; l++) {
+		float lo[3] = { lanes[0][l], lanes[1][l], lanes[2][l] };
+		float hi[3] = { lanes[3][l], lanes[4][l], lanes[5][l] };
+		bounds.Add(lo);
+		bounds.Add(hi);
+	}
+}
+
+// Four vertices at a time; returns how many it did
+static size_t TransformSse(const float* m, const float* n, VertexArrays& v, Bounds& bounds) {
+	size_t count = v.Count & ~(size_t)3;
+	if (count == 0) {
+		return 0;
+	}
+	__m128 minX = _mm_set1_ps(bounds.Min[0]), minY = _mm_set1_ps(bounds.Min[1]), minZ = _mm_set1_ps(bounds.Min[2]);
+	__m128 maxX = _mm_set1_ps(bounds.Max[0]), maxY = _mm_set1_ps(bounds.Max[1]), maxZ = _mm_set1_ps(bounds.Max[2]);
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+
+	for (size_t i = 0; i < count; i += 4) {
+		__m128 x = _mm_loadu_ps(v.X + i), y = _mm_loadu_ps(v.Y + i), z = _mm_loadu_ps(v.Z + i);
+		__m128 px = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0])), _mm_mul_ps(y, _mm_set1_ps(m[4]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[8])), _mm_set1_ps(m[12])));
+		__m128 py = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[1])), _mm_mul_ps(y, _mm_set1_ps(m[5]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[9])), _mm_set1_ps(m[13])));
+		__m128 pz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[2])), _mm_mul_ps(y, _mm_set1_ps(m[6]))), _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[10])), _mm_set1_ps(m[14])));
+		_mm_storeu_ps(v.X + i, px);
+		_mm_storeu_ps(v.Y + i, py);
+		_mm_storeu_ps(v.Z + i, pz);
+		minX = _mm_min_ps(minX, px); minY = _mm_min_ps(minY, py); minZ = _mm_min_ps(minZ, pz);
+		maxX = _mm_max_ps(maxX, px); maxY = _mm_max_ps(maxY, py); maxZ = _mm_max_ps(maxZ, pz);
+
+		__m128 nx = _mm_loadu_ps(v.NX + i), ny = _mm_loadu_ps(v.NY + i), nz = _mm_loadu_ps(v.NZ + i);
+		__m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(n[0])), _mm_mul_ps(ny, _mm_set1_ps(n[4]))), _mm_mul_ps(nz, _mm_set1_ps(n[8])));
+		__m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(n[1])), _mm_mul_ps(ny, _mm_set1_ps(n[5]))), _mm_mul_ps(nz, _mm_set1_ps(n[9])));
+		__m128 tz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(n[2])), _mm_mul_ps(ny, _mm_set1_ps(n[6]))), _mm_mul_ps(nz, _mm_set1_ps(n[10])));
+		// A full precision divide; rsqrt's 12 bits would show up in lighting
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+		__m128 scale = _mm_and_ps(_mm_div_ps(one, length), _mm_cmpgt_ps(length, zero));
+		_mm_storeu_ps(v.NX + i, _mm_mul_ps(tx, scale));
+		_mm_storeu_ps(v.NY + i, _mm_mul_ps(ty, scale));
+		_mm_storeu_ps(v.NZ + i, _mm_mul_ps(tz, scale));
+	}
+	StoreBounds(minX, minY, minZ, maxX, maxY, maxZ, bounds);
+	return count;
+}
+
+TARGET_AVX2 static size_t TransformAvx2(const float* m, const float* n, VertexArrays& v, Bounds& bounds) {
+	size_t count = v.Count & ~(size_t)7;
+	if (count == 0) {
+		return 0;
+	}
+	__m256 minX = _mm256_set1_ps(bounds.Min[0]), minY = _mm256_set1_ps(bounds.Min[1]), minZ = _mm256_set1_ps(bounds.Min[2]);
+	__m256 maxX = _mm256_set1_ps(bounds.Max[0]), maxY = _mm256_set1_ps(bounds.Max[1]), maxZ = _mm256_set1_ps(bounds.Max[2]);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+
+	for (size_t i = 0; i < count; i += 8) {
+		__m256 x = _mm256_loadu_ps(v.X + i), y = _mm256_loadu_ps(v.Y + i), z = _mm256_loadu_ps(v.Z + i);
+		__m256 px = _mm256_fmadd_ps(x, _mm256_set1_ps(m[0]), _mm256_fmadd_ps(y, _mm256_set1_ps(m[4]), _mm256_fmadd_ps(z, _mm256_set1_ps(m[8]), _mm256_set1_ps(m[12]))));
+		__m256 py = _mm256_fmadd_ps(x, _mm256_set1_ps(m[1]), _mm256_fmadd_ps(y, _mm256_set1_ps(m[5]), _mm256_fmadd_ps(z, _mm256_set1_ps(m[9]), _mm256_set1_ps(m[13]))));
+		__m256 pz = _mm256_fmadd_ps(x, _mm256_set1_ps(m[2]), _mm256_fmadd_ps(y, _mm256_set1_ps(m[6]), _mm256_fmadd_ps(z, _mm256_set1_ps(m[10]), _mm256_set1_ps(m[14]))));
+		_mm256_storeu_ps(v.X + i, px);
+		_mm256_storeu_ps(v.Y + i, py);
+		_mm256_storeu_ps(v.Z + i, pz);
+		minX = _mm256_min_ps(minX, px); minY = _mm256_min_ps(minY, py); minZ = _mm256_min_ps(minZ, pz);
+		maxX = _mm256_max_ps(maxX, px); maxY = _mm256_max_ps(maxY, py); maxZ = _mm256_max_ps(maxZ, pz);
+
+		__m256 nx = _mm256_loadu_ps(v.NX + i), ny = _mm256_loadu_ps(v.NY + i), nz = _mm256_loadu_ps(v.NZ + i);
+		__m256 tx = _mm256_fmadd_ps(nx, _mm256_set1_ps(n[0]), _mm256_fmadd_ps(ny, _mm256_set1_ps(n[4]), _mm256_mul_ps(nz, _mm256_set1_ps(n[8]))));
+		__m256 ty = _mm256_fmadd_ps(nx, _mm256_set1_ps(n[1]), _mm256_fmadd_ps(ny, _mm256_set1_ps(n[5]), _mm256_mul_ps(nz, _mm256_set1_ps(n[9]))));
+		__m256 tz = _mm256_fmadd_ps(nx, _mm256_set1_ps(n[2]), _mm256_fmadd_ps(ny, _mm256_set1_ps(n[6]), _mm256_mul_ps(nz, _mm256_set1_ps(n[10]))));
+		__m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(tx, tx, _mm256_fmadd_ps(ty, ty, _mm256_mul_ps(tz, tz))));
+		__m256 scale = _mm256_and_ps(_mm256_div_ps(one, length), _mm256_cmp_ps(length, zero, _CMP_GT_OQ));
+		_mm256_storeu_ps(v.NX + i, _mm256_mul_ps(tx, scale));
+		_mm256_storeu_ps(v.NY + i, _mm256_mul_ps(ty, scale));
+		_mm256_storeu_ps(v.NZ + i, _mm256_mul_ps(tz, scale));
+	}
+	StoreBounds(_mm256_castps256_ps128(minX), _mm256_castps256_ps128(minY), _mm256_castps256_ps128(minZ),
+		_mm256_castps256_ps128(maxX), _mm256_castps256_ps128(maxY), _mm256_castps256_ps128(maxZ), bounds);
+	StoreBounds(_mm256_extractf128_ps(minX, 1), _mm256_extractf128_ps(minY, 1), _mm256_extractf128_ps(minZ, 1),
+		_mm256_extractf128_ps(maxX, 1), _mm256_extractf128_ps(maxY, 1), _mm256_extractf128_ps(maxZ, 1), bounds);
+	return count;
+}
+
+void VertexTransform::Transform(const float matrix[16], const float normalMatrix[16], VertexArrays& vertices, Bounds& bounds) {
+	static const bool avx2 = HasAvx2();
+	size_t done = avx2 ? TransformAvx2(matrix, normalMatrix, vertices, bounds) : TransformSse(matrix, normalMatrix, vertices, bounds);
+	// What's left over doesn't fill a register
+	TransformScalar(matrix, normalMatrix, vertices, done, bounds);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+// Axis aligned bounds; empty until something is added
+struct Bounds {
+	float Min[3] = { 3.402823466e+38f, 3.402823466e+38f, 3.402823466e+38f };
+	float Max[3] = { -3.402823466e+38f, -3.402823466e+38f, -3.402823466e+38f };
+
+	void Add(const float* point);
+	void Add(const Bounds& other);
+	bool IsEmpty() const;
+};
+
+// Positions and normals as one array per component, so eight (AVX2) or four (SSE) vertices go through each step at once
+struct VertexArrays {
+	float* X;
+	float* Y;
+	float* Z;
+	float* NX;
+	float* NY;
+	float* NZ;
+	size_t Count;
+};
+
+// Matrices are row major and applied to row vectors, p' = p * M, the way FbxAMatrix stores them
+static class VertexTransform
+{
+public:
+	// Moves positions by matrix and normals by the upper 3x3 of normalMatrix (the inverse transpose), renormalises the
+	// normals, and adds the moved positions to bounds, all in one pass. AVX2 is used if the cpu has it.
+	static void Transform(const float matrix[16], const float normalMatrix[16], VertexArrays& vertices, Bounds& bounds);
+	static void TransformScalar(const float matrix[16], const float normalMatrix[16], VertexArrays& vertices, size_t first, Bounds& bounds);
+	static bool HasAvx2();
+};
\ No newline at end of file